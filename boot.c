@@ -0,0 +1,133 @@
+/**
+ * Staged boot sequence of the brewing monitor
+ *
+ * The slow parts of the startup are run as a protothread, so the sensors
+ * and communications are already running while EEPROM is initialized and
+ * the configuration is read. See boot.h.
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "inc/tm4c123gh6pm.h"
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+
+#include "pt.h"
+
+#include "common.h"
+#include "sched.h"
+#include "eeprom.h"
+#include "bubble.h"
+#include "warm.h"
+#include "boot.h"
+
+
+// From main.c
+extern eConfig systemConfig;
+extern eData latestData;
+extern threadTimer *storeTimer;
+extern void setDefaultConfig(void);
+
+static const warmState *bootWarm = 0;			// State kept over warm restart
+static threadTimer *bootTimer = 0;
+static struct pt bootChildPt;					// EEPROM initialization
+
+static uint32_t bootTimes[BOOT_MARKS];			// Milestone times [us]
+static uint8_t bootMarked = 0;					// Bit n is set when milestone n was reached
+
+
+void bootInit(const warmState *warm)
+{
+	bootWarm = warm;
+	bootTimer = getFreeTimer();
+}
+
+void bootMark(uint8_t mark)
+{
+	if(mark >= BOOT_MARKS || (bootMarked & (1 << mark))) return;
+	bootTimes[mark] = (uint32_t)getTimeUs();
+	bootMarked |= (1 << mark);
+}
+
+uint32_t bootGetTime(uint8_t mark)
+{
+	if(mark >= BOOT_MARKS || !(bootMarked & (1 << mark))) return 0;
+	return bootTimes[mark];
+}
+
+uint8_t bootReady(void)
+{
+	return (bootMarked & (1 << BOOT_CONFIG)) ? 1 : 0;
+}
+
+/**
+ * Boot stages, run once
+ * The configuration read from EEPROM replaces the defaults the sensors
+ * were started with. It is read into a copy first, since other threads
+ * run while it is echoed to UART.
+ */
+PT_THREAD(bootLoop(struct pt *pt))
+{
+	static eConfig config;
+	static uint8_t i;
+
+	PT_BEGIN(pt);
+
+	// Initialize eeprom, continue at the saved write position after a warm restart
+	PT_SPAWN(pt, &bootChildPt, eInitThread(&bootChildPt, bootTimer, bootWarm ? &bootWarm->cursor : 0));
+
+	if(!eIsOK()) {
+		PT_WAIT_UNTIL(pt, UARTSend("Eeprom fail!\r\n", 14));
+		if(!bootWarm) setDefaultConfig();
+	} else if(bootWarm) {
+		PT_WAIT_UNTIL(pt, UARTSend("Warm\r\n", 6));
+	} else {
+		// Try and read the configuration word...
+		eReadConfig(&config);
+		if(config.bubbleLevel == 255) {
+			PT_WAIT_UNTIL(pt, UARTSend("Default conf\r\n", 14));
+			setDefaultConfig();
+		} else {
+			systemConfig = config;
+
+			// Set the values to subsystems
+			bubbleSetThreshold(systemConfig.bubbleLevel);
+			if(systemConfig.flags & CONF_BUBBLE_AUTOLEVEL) bubbleSetThreshold(0);	// Auto level on
+
+			PT_WAIT_UNTIL(pt, UARTSendInt(config.bubbleLevel));
+			PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+			PT_WAIT_UNTIL(pt, UARTSendInt(config.storeInterval));
+			PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+		}
+	}
+
+	// Initialize timer for storing data to EEPROM
+	latestData.n = eGetNextNum();
+	storeTimer = getFreeTimer();
+	if(storeTimer)
+		timerStart(storeTimer, systemConfig.storeInterval * 60000);		// Given in minutes
+
+	bootMark(BOOT_CONFIG);
+
+	// Report when the first sample and RF packet have been seen
+	// Milestones are taken by other threads, so they are checked every tick
+	if(bootTimer) {
+		timerStart(bootTimer, BOOT_REPORT_TIMEOUT);
+		SCHED_WAIT_UNTIL(pt, bootTimer, SCHED_EV_TICK,
+			bootMarked == (1 << BOOT_MARKS) - 1 || timerExpired(bootTimer));
+	}
+
+	PT_WAIT_UNTIL(pt, UARTSend("Boot:", 5));
+	for(i=0; i < BOOT_MARKS; i++) {
+		if(i) PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+		PT_WAIT_UNTIL(pt, UARTSendInt(bootGetTime(i)));
+	}
+	PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+
+	SCHED_STOP(pt);
+
+	PT_END(pt);
+}
@@ -0,0 +1,44 @@
+#ifndef __BOOT_H__
+#define __BOOT_H__
+
+// Staged boot sequence
+//
+// main() only sets up the peripherals that are quick to bring up and then
+// starts the scheduler, so the bubble sensor is sampled right away. The slow
+// stages are run by the boot thread in the background, concurrently with the
+// sensors: EEPROM initialization (retried on timer), reading and reporting
+// the configuration, and starting the EEPROM store timer. Until the
+// configuration has been read the default one (or the one kept over a warm
+// restart) is used.
+//
+// Milestones are timestamped once with bootMark() and reported on UART as
+//   Boot:<first sample>,<first RF packet>,<configuration ready>
+// in microseconds since reset, when all were reached or BOOT_REPORT_TIMEOUT
+// has passed. A milestone that was not reached is reported as 0.
+
+#define BOOT_FIRST_SAMPLE		0				// First bubble sensor sample taken
+#define BOOT_FIRST_RF			1				// First RF packet acknowledged
+#define BOOT_CONFIG				2				// Configuration read, EEPROM ready
+#define BOOT_MARKS				3
+
+#define BOOT_REPORT_TIMEOUT		10000			// Report at latest this long after the configuration [ms]
+
+// Store the state kept over a warm restart (0 after a cold start),
+// called from main() before the scheduler is started
+struct _warmState;
+void bootInit(const struct _warmState *warm);
+
+// Boot thread, ends after the report
+PT_THREAD(bootLoop(struct pt *pt));
+
+// Take the time of a milestone, only the first call counts
+void bootMark(uint8_t mark);
+
+// Time of a milestone [us since reset], 0 if not reached yet
+uint32_t bootGetTime(uint8_t mark);
+
+// Returns 1 when the configuration has been read and EEPROM is ready,
+// i.e. data can be stored and the warm restart state saved
+uint8_t bootReady(void);
+
+#endif
@@ -22,10 +22,12 @@
 // PB2    = DS18B20 1-wire data pin  ( ext. pull-up)
 // PB3    = NRF24L01 CE
 // PB4    = NRF24L01 CSN
-// PB5    = CO2 volume sensor (HALL switch)
+// PB5
 // PB6
 // PB7
 
+// PD0    = CO2 volume sensor (HALL switch), interrupt on both edges
+
 // PE0
 // PE1    = Bubble sensor LDR in (AIN2)
 // PE2
@@ -45,8 +47,8 @@
 
 
 // Other
-// ADC0 sequence 0 channel 1  = Bubble sensor LDR
-// ADC0 sequence 1 channel 0  = MQ3 sensor
+// ADC0 sequence 0 channel 1  = Bubble sensor LDR, triggered by TIMER1, samples moved by uDMA channel 14
+// ADC0 sequence 1 channel 0  = MQ3 sensor, 4 samples averaged per reading
 
 
 // RF commands
@@ -54,13 +56,19 @@
 // d		= Request EEPROM dump
 // f000		= Set config flags, 000 is uint8 in decimal for the flags
 // w		= Write config to eeprom, returns W if ok, F if failed, then K (ACK)
+// i		= Request profiling counters (only when built with PROFILE), ends with K
+// t		= Request event trace (only when built with TRACE), same Z and X records as on UART, ends with K
 
 // RF messages
 // A		= Acknowledge last commands
-// BAAAABBBBCCCCDDDD					// Bubble sensor A=raw value, sensor latest B=threshold, C=maximum and D=minimum values
+// BAAAABBBBCCCCDDDD					// Bubble sensor A=raw value, sensor latest B=threshold, C=high and D=low percentiles (auto level limits)
 // DAAAAAAAABBBBCCCCDDDDDDDDEEEEFFG		// Data packet, values in hex, A=weight, B=temperature, C=ethanol, D=bubble integral, E=co2 integral, F=package number, G=new data flags
+// NAAAAAAAABBBBCCCCFF				// Bubble events, sent after D and E packets, A=bubbles counted, B=rate [0.1 / min], C=latest bubble length [ms], F=package number
 // CAAAABBBBCCCCDDEEEE					// Config word, values in hex, A=bubble sensor threshold, B=eeprom write interval, C=config flags, D=next write block number, E=eeprom write timer value
-// EXXX		= Eemprom data packet (data that was stored to eeprom), same contents as with D data packet
+// INNAAAAAAAABBBBBBBBCCCCCCCC		// Profiling counters, N=counter (threads from 00, timed functions after them), A=runs, B=runs without progress, C=total run time [us]
+// JNNAAAAAAAABBBBBBBB					// Profiling counters, N=counter, A=shortest and B=longest run [clock cycles]
+// IFFAA								// Profiling, A=percentage of time spent sleeping, last of the profiling packets
+// EXXX		= Eemprom data packet (data that was stored to eeprom), same contents as with D data packet, followed by N
 // K		= Done with (end of) multi-packet messages
 // P		= Ping
 
@@ -75,11 +83,51 @@
 // pXXX = Set output printing interval in 10 ms intervals (1...999) TODO
 // fXXX = Set config flags (0...255) 
 // x170 = Reset whole eeprom (0xAA, 0b10101010)
+// a    = Print resource arbitration statistics, one line per resource:
+//        AN:G,Q,W,T where N=resource (0=exact timers, 1=ADC0, 2=SSI0), G=times granted,
+//        Q=longest queue, W=longest wait [us], T=total wait [us]
+// g    = Print release statistics of periodic threads, one line per thread:
+//        GN:R,O,J,T where N=thread (0=bubble, 1=hx711, 2=mq3, 3=ds18b20), R=releases,
+//        O=overruns (skipped releases), J=max jitter [ms], T=total jitter [ms]
+// i    = Print profiling counters (only when built with PROFILE), one line per thread and timed function:
+//        PN:R,S,T,L,H for thread N and QN:... for timed function N, R=runs, S=runs without progress,
+//        T=total run time [us], L=shortest and H=longest run [clock cycles]
+//        WN:C,E,M timed function wait accuracy, N=0 exact timer and 1 spun waits, C=waits,
+//        E=total and M=largest overshoot [clock cycles]
+//        Last line IXX, XX=percentage of time spent sleeping
+// j    = Clear profiling counters (only when built with PROFILE)
+// v    = Print thread restarts by the supervisor, one line per thread: VN:R, N=thread (task table order,
+//        0=bubble, 1=hx711, 2=mq3, 3=ds18b20, 4=serial, 5=radio, 6=boot), R=restarts for missing liveness deadline
+//        "Watchdog" is printed at startup if the previous run was reset by the watchdog
+// m    = Print memory use: M:S,U,F, S=static RAM (data and bss), U=deepest stack use since reset and
+//        F=stack never used, i.e. what more buffers can take [bytes]. Static RAM per module: tools/ramreport.sh
+// u    = Print power states, one line per subsystem: UN:S,T0,T1,T2,C, N=0 cpu, 1 hx711, 2 radio, 3 ADC,
+//        S=current state (0 sleep, 1 idle, 2 active), T0..T2=time in each state [ms], C=estimated charge [uAh]
+// kX   = Set timed function wait policy, X=0 spin waits below the calibrated limit, 1 spin all waits,
+//        2 use exact timer for all waits. Replies TN, N=waits shorter than N us are spun
+//        Benchmark: clear counters (j), let the 1-Wire thread run and compare the ds*Timed lines of 'i'
+//        (CPU time), 'h' (interrupt time) and W lines (accuracy) under each policy
+// e    = Measure GPIO access cost (only when built with PROFILE): E:A,B,C,D, cycles of 8 writes with
+//        driverlib (A) and pin.h (B), 8 reads with driverlib (C) and pin.h (D). Clock edge is one write,
+//        1-Wire slot two writes and a read
+// h    = Print and clear interrupt histograms (only when built with PROFILE_ISR), two lines per interrupt:
+//        HNL:B0,...,B15,M (entry latency) and HND:B0,...,B15,M (duration), N=interrupt (0=system tick,
+//        1=exact timers, 2=UART, 3=bubble ADC, 4=Co2 Hall switch), Bn=count of values 2^n...2^(n+1)-1 clock cycles, M=largest value [cycles]
+//        UART, ADC and Co2 latency is not measured (time of the receive, block end or edge is not known)
+// t    = Read out and clear the event trace (only when built with TRACE, see trace.h), all values in hex:
+//        ZLLLLLLLLCCCCCCCCUUUUUUUU header, L=events lost, C=timebase [cycles] and U=timebase [us] at read out
+//        XTTTTTTTTIIIIAAAA per event, T=timebase [cycles], I=event id (TRACE_*) and A=argument, ends with K
+//        Decode a captured log with tools/tracedecode.py
+
+// Printed once after startup (boot.h)
+// Boot:S,R,C = Time of the first bubble sensor sample (S), first acknowledged RF packet (R) and
+//              configuration read from EEPROM (C) [us since reset], 0 if not reached in time
 
 // Values printed out all the time on UART
 // BXXX  = Bubbling sensor integral value, XXX is uint32_t
+// NX,Y,Z = Bubble counted (with integral echo), X=bubbles, Y=rate [0.1 / min], Z=length of the latest complete bubble [ms]
 // RXXX  = Bubbling sensor raw ADC value
-// CXXX  = Co2 volume sensor integral, XXX is uint32_t
+// CX,Y,Z = Co2 volume sensor, X=integral (changes counted), Y=latest fill time [ms], Z=fills per hour [0.1 / h]
 // EXXX  = Ethanol sensor raw value
 // WXXX  = Weight sensor raw value
 // TXXX  = Temperature measurement raw value
@@ -4,6 +4,20 @@
  * Supports airlock bubbling sensor and a fill-and-dump type
  * volumetric sensor
  *
+ * The airlock sensor is sampled at BUBBLE_SAMPLE_RATE: TIMER1 triggers
+ * ADC0 sequence 0 and uDMA moves the samples to two ping-pong buffers,
+ * so the sample rate does not depend on the scheduler and short bubbles
+ * are not missed between samples. The thread processes one full buffer
+ * per BUBBLE_TIME_INTERVAL while uDMA fills the other one. Samples are
+ * decimated and low pass filtered (filter.h) before detection, so single
+ * noise spikes do not become bubbles.
+ *
+ * The Hall switch of the volumetric sensor interrupts on both edges and
+ * the interrupt stores the time and level of every edge to a ring buffer.
+ * The thread counts the changes from the buffer, so a fill-and-dump flip
+ * shorter than the block time is not missed and the fill times come from
+ * the edge times instead of the thread schedule.
+ *
  * Uses protothreads (by Adam Dunkels, http://dunkels.com/adam/pt/)
  *
  * Copyright (C) 2016 Lauri Peltonen
@@ -15,18 +29,27 @@ typedef uint8_t bool;
 #include "inc/tm4c123gh6pm.h"
 #include "inc/hw_types.h"
 #include "inc/hw_memmap.h"
+#include "inc/hw_adc.h"
 
 #include "driverlib/sysctl.h"
 #include "driverlib/gpio.h"
 #include "driverlib/adc.h"
 #include "driverlib/interrupt.h"
 #include "driverlib/timer.h"
+#include "driverlib/udma.h"
 
 #include "pt.h"
 
 #include "common.h"
+#include "sched.h"
 #include "eeprom.h"
+#include "bubbledetect.h"
+#include "filter.h"
+#include "quantile.h"
 #include "bubble.h"
+#include "boot.h"
+#include "trace.h"
+#include "profile.h"
 
 
 // From main.c
@@ -40,40 +63,208 @@ const uint32_t bubblePin = GPIO_PIN_1;						// PE1 (AIN2)		// Oli PIN_1???
 const uint32_t bubbleADCPeripheral = SYSCTL_PERIPH_ADC0;
 const uint32_t bubbleADC = ADC0_BASE;
 const uint32_t bubbleADCSeq = 0;							// ADC sequence number
+const uint32_t bubbleADCInt = INT_ADC0SS0;
+
+const uint32_t bubbleTimerPeripheral = SYSCTL_PERIPH_TIMER1;	// Sample trigger
+const uint32_t bubbleTimer = TIMER1_BASE;
+
+const uint32_t bubbleDMAChannel = UDMA_CHANNEL_ADC0;		// Channel 14, ADC0 sequence 0
 
 const uint32_t bubbleCo2Peripheral = SYSCTL_PERIPH_GPIOD;
 const uint32_t bubbleCo2Port = GPIO_PORTD_BASE;
 const uint32_t bubbleCo2Pin = GPIO_PIN_0;					// PD0
+const uint32_t bubbleCo2Int = INT_GPIOD;
 
 
 // Other variables
-static const uint8_t bubbleLevelMargin = 200;				// Margin when using auto level
-static uint16_t bubbleLevelTimer = BUBBLE_AUTOLEVEL_CYCLES;
+static quantile bubbleLow;									// Percentiles of the filtered signal
+static quantile bubbleHigh;
 
 // This counter increases every time a bubble is detected
 // uint32 can store about 49 days with 1 ms timer
 static uint8_t bubbleFlags = 0;								// bit 0 = data is valid, bit 1 = new data
 static uint32_t bubbleIntegral = 0;
 static uint8_t bubbleDetected = 0;							// 1 if last sample had a bubble
+static bubbleDetector bubbleEvents = { BUBBLE_FILTER_RATE };	// Counts bubbles, same as bubbleDetectInit()
 
 static uint8_t bubbleCo2LastState = 0;
 static uint16_t bubbleCo2 = 0;
+static uint8_t bubbleCo2Started = 0;						// A change has been counted since reset, i.e. time is valid
+static uint32_t bubbleCo2Time = 0;							// Time of the latest change [ms]
+static uint32_t bubbleCo2Period = 0;						// Between the latest two changes [ms], 0 until known
+
+// Hall switch edges, written by the interrupt and read by the thread
+typedef struct _bubbleCo2Edge {
+	uint32_t time;											// [ms] getTime()
+	uint8_t level;											// Pin level after the edge
+} bubbleCo2Edge;
+
+static bubbleCo2Edge bubbleCo2Edges[BUBBLE_CO2_EVENTS];
+static volatile uint8_t bubbleCo2Head = 0;					// Next edge is written here
+static volatile uint8_t bubbleCo2Tail = 0;					// Oldest edge not yet processed
+
 
+// uDMA control table, must be aligned to its size. Only the ADC0 channel is used
+static uint8_t bubbleDMATable[1024] __attribute__ ((aligned(1024)));
+
+// Ping-pong buffers, 0 is filled by the primary and 1 by the alternate control structure
+static const uint32_t bubbleDMASelect[2] = { UDMA_PRI_SELECT, UDMA_ALT_SELECT };
+static uint16_t bubbleBuffer[2][BUBBLE_BLOCK_SIZE];
+static volatile uint8_t bubbleBlockReady = 0;				// Bit n set when buffer n is full
+static uint8_t bubbleBlock = 0;								// Buffer to process next
+
+// Decimation and low pass of the samples (filter.h)
+static filter bubbleFilter;
+static int16_t bubbleFiltered[(BUBBLE_BLOCK_SIZE >> BUBBLE_CIC_SHIFT) + 1];
 
-static uint32_t ulData[bubbleADCFifoDepth];
 static uint16_t bubbleSensorValue = 0;
 
 static uint8_t bubbleAutoLevel = 1;							// Set to 1 (set level to 0 to automatically tune the threshold
-static uint16_t bubbleSensorMax = 0x0FFF;						// Auto leveling top and bottom limits
+static uint16_t bubbleSensorMax = 0x0FFF;						// Auto leveling top and bottom limits (percentiles)
 static uint16_t bubbleSensorMin = 0;
 static uint16_t bubbleLevel = 820;							// Bubble detection level in ADC values
+static uint8_t bubbleIdle = 0;								// Percentiles too close for bubbles, detection suppressed
 
 
-// Timer
-uint32_t *bubbleTimer;
+// Arm the uDMA control structure of buffer n
+static inline void _bubbleDMAArm(uint8_t n)
+{
+	uDMAChannelTransferSet(bubbleDMAChannel | bubbleDMASelect[n], UDMA_MODE_PINGPONG,
+		(void *)(bubbleADC + ADC_O_SSFIFO0), bubbleBuffer[n], BUBBLE_BLOCK_SIZE);
+}
+
+/**
+ * Configure the sample chain: TIMER1 triggers one conversion of ADC0
+ * sequence 0 per sample and uDMA moves it to the current buffer.
+ * Can be called again to restart sampling from buffer 0
+ */
+static void _bubbleADCInit(void)
+{
+	bool bInt;
+
+	TimerDisable(bubbleTimer, TIMER_A);
+	uDMAChannelDisable(bubbleDMAChannel);
+	ADCSequenceDisable(bubbleADC, bubbleADCSeq);
+
+	// Highest priority, conversions of the ethanol sensor (sequence 1) wait for it
+	ADCSequenceConfigure(bubbleADC, bubbleADCSeq, ADC_TRIGGER_TIMER, 0);
+	ADCSequenceStepConfigure(bubbleADC, bubbleADCSeq, 0, ADC_CTL_CH2 | ADC_CTL_IE | ADC_CTL_END);
+	ADCSequenceDMAEnable(bubbleADC, bubbleADCSeq);
+
+	// One 16-bit transfer per request from the sequence FIFO
+	uDMAChannelAssign(UDMA_CH14_ADC0_0);
+	uDMAChannelAttributeDisable(bubbleDMAChannel, UDMA_ATTR_ALTSELECT | UDMA_ATTR_USEBURST |
+		UDMA_ATTR_HIGH_PRIORITY | UDMA_ATTR_REQMASK);
+	uDMAChannelControlSet(bubbleDMAChannel | UDMA_PRI_SELECT, UDMA_SIZE_16 | UDMA_SRC_INC_NONE | UDMA_DST_INC_16 | UDMA_ARB_1);
+	uDMAChannelControlSet(bubbleDMAChannel | UDMA_ALT_SELECT, UDMA_SIZE_16 | UDMA_SRC_INC_NONE | UDMA_DST_INC_16 | UDMA_ARB_1);
+	_bubbleDMAArm(0);
+	_bubbleDMAArm(1);
+
+	bInt = IntMasterDisable();
+	bubbleBlockReady = 0;
+	bubbleBlock = 0;
+	if(!bInt) IntMasterEnable();
+
+	uDMAChannelEnable(bubbleDMAChannel);
+	ADCIntClear(bubbleADC, bubbleADCSeq);
+	ADCSequenceEnable(bubbleADC, bubbleADCSeq);
+
+	TimerLoadSet(bubbleTimer, TIMER_A, SYSTEM_CLOCK / BUBBLE_SAMPLE_RATE - 1);
+	TimerEnable(bubbleTimer, TIMER_A);
+}
+
+/**
+ * ADC0 sequence 0 interrupt
+ * With uDMA enabled the sequence interrupts when a buffer is complete.
+ * The finished buffer is re-armed right away, it is filled again only
+ * after the other one, so the thread has one block time to process it
+ */
+void __attribute__ ((interrupt)) bubbleADCIntHandler(void)
+{
+	uint8_t n;
+	PROFILE_ISR_ENTER(PROFILE_ISR_NO_LATENCY);
+
+	ADCIntClear(bubbleADC, bubbleADCSeq);
+
+	for(n = 0; n < 2; n++) {
+		if(uDMAChannelModeGet(bubbleDMAChannel | bubbleDMASelect[n]) == UDMA_MODE_STOP) {
+			// Bit 8 of the argument tells that the block was not processed in time
+			TRACE_EVENT(TRACE_ISR_ADC, n | ((bubbleBlockReady & (1 << n)) ? 0x100 : 0));
+			bubbleBlockReady |= 1 << n;
+			_bubbleDMAArm(n);
+			schedSignal(SCHED_EV_ADC);
+		}
+	}
+
+	PROFILE_ISR_EXIT(PROFILE_ISR_ADC);
+}
+
+/**
+ * GPIO port D interrupt, both edges of the Hall switch
+ * Level is read in the interrupt, a bouncing switch may give edges with
+ * the same level, the thread only counts levels that stay. If the thread
+ * has not emptied the buffer the edge is dropped, the next edge still
+ * brings the current level
+ */
+void __attribute__ ((interrupt)) bubbleCo2IntHandler(void)
+{
+	uint8_t head, next;
+	PROFILE_ISR_ENTER(PROFILE_ISR_NO_LATENCY);
+
+	GPIOIntClear(bubbleCo2Port, bubbleCo2Pin);
+
+	head = bubbleCo2Head;
+	next = (head + 1) & (BUBBLE_CO2_EVENTS - 1);
+	if(next != bubbleCo2Tail) {
+		bubbleCo2Edges[head].time = getTime();
+		bubbleCo2Edges[head].level = GPIOPinRead(bubbleCo2Port, bubbleCo2Pin);
+		bubbleCo2Head = next;
+		TRACE_EVENT(TRACE_ISR_CO2, bubbleCo2Edges[head].level ? 1 : 0);
+	} else {
+		// Bit 8 of the argument tells that the edge was dropped
+		TRACE_EVENT(TRACE_ISR_CO2, 0x100);
+	}
+
+	PROFILE_ISR_EXIT(PROFILE_ISR_CO2);
+}
+
+/**
+ * Count the Hall switch changes from the edge buffer
+ * A level counts when it has stayed for BUBBLE_CO2_DEBOUNCE, i.e. until
+ * the next edge or until now. The newest edge stays in the buffer until
+ * it is old enough. The time of the change is the time of its edge
+ */
+static void _bubbleCo2Process(void)
+{
+	uint8_t tail = bubbleCo2Tail;
+	uint8_t head = bubbleCo2Head;
+	uint8_t next;
+	uint32_t end;
+	bubbleCo2Edge *edge;
+
+	while(tail != head) {
+		edge = &bubbleCo2Edges[tail];
+		next = (tail + 1) & (BUBBLE_CO2_EVENTS - 1);
+		end = (next != head) ? bubbleCo2Edges[next].time : getTime();
+		if(end - edge->time < BUBBLE_CO2_DEBOUNCE && next == head) break;		// Check again on the next block
+
+		if(end - edge->time >= BUBBLE_CO2_DEBOUNCE && edge->level != bubbleCo2LastState) {
+			bubbleCo2++;									// Increase integral on every state change (i.e. emptying or filling)
+			bubbleCo2LastState = edge->level;
+			if(bubbleCo2Started) bubbleCo2Period = edge->time - bubbleCo2Time;
+			bubbleCo2Time = edge->time;
+			bubbleCo2Started = 1;
+		}
+		tail = next;
+	}
+
+	bubbleCo2Tail = tail;
+}
 
 void bubbleSetup(void)
 {
+	bool bInt;
+
 	// Configure input pins
 	if(!SysCtlPeripheralReady(bubblePeripheral))
 	{
@@ -95,93 +286,143 @@ void bubbleSetup(void)
 	GPIOPinTypeGPIOInput(bubbleCo2Port, bubbleCo2Pin);
 	GPIOPadConfigSet(bubbleCo2Port, bubbleCo2Pin, GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
 
-	// Configure ADC peripheral
+	// Interrupt on both edges. The level at start is the first edge, so a change
+	// while the power was off (or during a warm restart) is counted as before
+	GPIOIntDisable(bubbleCo2Port, bubbleCo2Pin);
+	GPIOIntTypeSet(bubbleCo2Port, bubbleCo2Pin, GPIO_BOTH_EDGES);
+	GPIOIntClear(bubbleCo2Port, bubbleCo2Pin);
+	GPIOIntRegister(bubbleCo2Port, bubbleCo2IntHandler);
+
+	bInt = IntMasterDisable();
+	bubbleCo2Edges[0].time = getTime();
+	bubbleCo2Edges[0].level = GPIOPinRead(bubbleCo2Port, bubbleCo2Pin);
+	bubbleCo2Tail = 0;
+	bubbleCo2Head = 1;
+	if(!bInt) IntMasterEnable();
+
+	GPIOIntEnable(bubbleCo2Port, bubbleCo2Pin);
+	IntEnable(bubbleCo2Int);
+
+	// Configure ADC, sample timer and uDMA peripherals
 	if(!SysCtlPeripheralReady(bubbleADCPeripheral))
 	{
 		SysCtlPeripheralEnable(bubbleADCPeripheral);
 		while(!SysCtlPeripheralReady(bubbleADCPeripheral));
 	}
 
-	ADCSequenceDisable(bubbleADC, bubbleADCSeq);
-	ADCSequenceConfigure(bubbleADC, bubbleADCSeq, ADC_TRIGGER_PROCESSOR, 0);
-	ADCSequenceStepConfigure(bubbleADC, bubbleADCSeq, 0, ADC_CTL_CH2 | ADC_CTL_IE | ADC_CTL_END);
-	ADCSequenceEnable(bubbleADC, bubbleADCSeq);
-	
-	bubbleTimer = getFreeTimer();
-	if(bubbleTimer) *bubbleTimer = BUBBLE_TIME_INTERVAL;
+	if(!SysCtlPeripheralReady(bubbleTimerPeripheral))
+	{
+		SysCtlPeripheralEnable(bubbleTimerPeripheral);
+		while(!SysCtlPeripheralReady(bubbleTimerPeripheral));
+	}
+
+	if(!SysCtlPeripheralReady(SYSCTL_PERIPH_UDMA))
+	{
+		SysCtlPeripheralEnable(SYSCTL_PERIPH_UDMA);
+		while(!SysCtlPeripheralReady(SYSCTL_PERIPH_UDMA));
+	}
+	uDMAEnable();
+	uDMAControlBaseSet(bubbleDMATable);
+
+	// Timer output triggers the ADC, no timer interrupts
+	TimerConfigure(bubbleTimer, TIMER_CFG_PERIODIC);
+	TimerControlTrigger(bubbleTimer, TIMER_A, 1);
+
+	ADCIntRegister(bubbleADC, bubbleADCSeq, bubbleADCIntHandler);
+	ADCIntEnable(bubbleADC, bubbleADCSeq);
+	IntEnable(bubbleADCInt);
+
+	filterInit(&bubbleFilter, BUBBLE_CIC_ORDER, BUBBLE_CIC_SHIFT, filterLowpass8, 8);
+	_bubbleADCInit();
+
+	// Start from the limits, which may have been restored after warm restart
+	quantileInit(&bubbleLow, BUBBLE_QUANTILE_LOW, BUBBLE_QUANTILE_STEP, bubbleSensorMin);
+	quantileInit(&bubbleHigh, BUBBLE_QUANTILE_HIGH, BUBBLE_QUANTILE_STEP, bubbleSensorMax);
+}
+
+/**
+ * Thread was restarted by the supervisor, i.e. no blocks came from uDMA
+ * Restarts the sample timer, the sequencer, uDMA and the filter
+ */
+void bubbleRecover(void)
+{
+	filterInit(&bubbleFilter, BUBBLE_CIC_ORDER, BUBBLE_CIC_SHIFT, filterLowpass8, 8);
+	_bubbleADCInit();
 }
 
 
 
 PT_THREAD(bubbleLoop(struct pt *pt))
 {
-	uint8_t temp;
+	uint16_t i;
+	uint16_t sample;
+	uint16_t filtered;
+	bool bInt;
 	PT_BEGIN(pt);
 
 	while(1) {
-		// Reset data valid before conversion
-		bubbleFlags &= 0xFE;
+		// Wait until uDMA has filled the next buffer
+		// The loop returns to this wait after every block, passing it is the progress the supervisor sees
+		SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_ADC, bubbleBlockReady & (1 << bubbleBlock));
 
-		ADCIntClear(bubbleADC, bubbleADCSeq);
-		ADCProcessorTrigger(bubbleADC, bubbleADCSeq);
+		// Filter out noise spikes, then the buffer can be filled again
+		filtered = filterBlock(&bubbleFilter, bubbleBuffer[bubbleBlock], BUBBLE_BLOCK_SIZE, bubbleFiltered);
+		bInt = IntMasterDisable();
+		bubbleBlockReady &= ~(1 << bubbleBlock);
+		if(!bInt) IntMasterEnable();
+		bubbleBlock ^= 1;
 
-		// Wait until conversion is complete
-		// Releases the thread here
-		PT_WAIT_UNTIL(pt, ADCIntStatus(bubbleADC, bubbleADCSeq, 0));
+		if(!filtered) continue;								// Filter is still settling
 
-		ADCSequenceDataGet(bubbleADC, bubbleADCSeq, ulData);
-		bubbleSensorValue = (uint16_t)ulData[0];
+		// Reset data valid while processing
+		bubbleFlags &= 0xFE;
+		bootMark(BOOT_FIRST_SAMPLE);
+
+		// Keeps track of the signal percentiles
+		// Block value is the sample deepest in the bubble direction,
+		// so a bubble shorter than the block is detected
+		// Every sample goes through the bubble event detector
+		bubbleDetectSetLevel(&bubbleEvents, bubbleLevel, bubbleDetectHysteresis(bubbleSensorMax, bubbleSensorMin),
+			(systemConfig.flags & CONF_BUBBLE_INVERT) ? 1 : 0);
+		for(i = 0; i < filtered; i++) {
+			sample = (bubbleFiltered[i] > 0) ? bubbleFiltered[i] : 0;
+			if(!bubbleIdle) bubbleDetectSample(&bubbleEvents, sample);
+			quantileUpdate(&bubbleLow, sample);
+			quantileUpdate(&bubbleHigh, sample);
+			if(i == 0 ||
+				(!(systemConfig.flags & CONF_BUBBLE_INVERT) && sample < bubbleSensorValue) ||
+				((systemConfig.flags & CONF_BUBBLE_INVERT) && sample > bubbleSensorValue))
+				bubbleSensorValue = sample;
+		}
+		if(bubbleIdle) bubbleDetectIdle(&bubbleEvents, filtered);
 
-		if((!(systemConfig.flags & CONF_BUBBLE_INVERT) && bubbleSensorValue <= bubbleLevel) ||
-			((systemConfig.flags & CONF_BUBBLE_INVERT) && bubbleSensorValue >= bubbleLevel)) {
+		if(!bubbleIdle &&
+			((!(systemConfig.flags & CONF_BUBBLE_INVERT) && bubbleSensorValue <= bubbleLevel) ||
+			((systemConfig.flags & CONF_BUBBLE_INVERT) && bubbleSensorValue >= bubbleLevel))) {
 			bubbleDetected = 1;
-			bubbleIntegral++;
+			bubbleIntegral++;								// Counts blocks, i.e. BUBBLE_TIME_INTERVAL
 		} else {
 			bubbleDetected = 0;
 		}
 		
+		// Limits follow the percentiles
+		bubbleSensorMax = quantileGet(&bubbleHigh);
+		bubbleSensorMin = quantileGet(&bubbleLow);
+
 		// Tune the threshold in auto leveling mode
-		// Keeps also track of the maximum and minimum signal levels
-		if(bubbleSensorValue > bubbleSensorMax) bubbleSensorMax = bubbleSensorValue;
-		if(bubbleSensorValue < bubbleSensorMin) bubbleSensorMin = bubbleSensorValue;
-		if(bubbleAutoLevel) {
-			bubbleLevel = (bubbleSensorMax / 2) + (bubbleSensorMin / 2);			// Use middle as threshold
-		}
-		if(!bubbleLevelTimer) {
-			bubbleLevelTimer = BUBBLE_AUTOLEVEL_CYCLES;
-			
-			// Slowly pull limits together, keeping margin between them
-			// Pull top level faster than bottom level, or other way if inverter
-			if(bubbleSensorMax > bubbleSensorMin + bubbleLevelMargin) bubbleSensorMax--;
-			if(!(systemConfig.flags & CONF_BUBBLE_INVERT)) {
-				if(bubbleSensorMax > bubbleSensorMin + bubbleLevelMargin) bubbleSensorMax--;
-				if(bubbleSensorMax > bubbleSensorMin + bubbleLevelMargin) bubbleSensorMax--;
-			}
-
-			if(bubbleSensorMin < bubbleSensorMax - bubbleLevelMargin) bubbleSensorMin++;
-			if(systemConfig.flags & CONF_BUBBLE_INVERT) {
-				if(bubbleSensorMin < bubbleSensorMax - bubbleLevelMargin) bubbleSensorMin++;
-				if(bubbleSensorMin < bubbleSensorMax - bubbleLevelMargin) bubbleSensorMin++;
-			}
-		} else {
-			bubbleLevelTimer--;
-		}
+		// A window narrower than the margin is only noise, i.e. an idle airlock, so
+		// detection is suppressed instead of using a threshold next to the idle level.
+		// The threshold keeps its last real value. A bubble widens the window within
+		// its first samples, which ends the idle state again
+		bubbleIdle = (bubbleAutoLevel && bubbleSensorMax < bubbleSensorMin + BUBBLE_LEVEL_MARGIN) ? 1 : 0;
+		if(bubbleAutoLevel && !bubbleIdle)
+			bubbleLevel = (bubbleSensorMax / 2) + (bubbleSensorMin / 2);		// Use middle as threshold
 
-		// Read the Co2 sensor status
-		temp = GPIOPinRead(bubbleCo2Port, bubbleCo2Pin);
-		if(temp != bubbleCo2LastState) {
-			bubbleCo2++;									// Increase integral on every state change (i.e. emptying or filling)
-			bubbleCo2LastState = temp;
-		}
+		// Count the Co2 sensor changes the interrupt has seen
+		_bubbleCo2Process();
 
 		// Data is valid, and new data is available
 		bubbleFlags |= 0x03;								// Bits 0 and 1
-
-		// Wait for next running time, i.e. timer to trig
-		if(bubbleTimer) {
-			*bubbleTimer = BUBBLE_TIME_INTERVAL;	// TODO: Should be moved to top of the function for timing accuracy
-			PT_WAIT_WHILE(pt, *bubbleTimer);
-		}
 	}
 
 	PT_END(pt);
@@ -218,21 +459,39 @@ uint32_t bubbleGetIntegral()
 	return bubbleIntegral;
 }
 
+uint32_t bubbleGetCount(void)
+{
+	return bubbleEvents.count;
+}
+
+uint16_t bubbleGetRate(void)
+{
+	return bubbleDetectGetRate(&bubbleEvents);
+}
+
+uint16_t bubbleGetLength(void)
+{
+	return bubbleEvents.length;
+}
+
 void bubbleSetThreshold(uint8_t threshold)
 {
 	if(threshold == 0) {
 		bubbleAutoLevel = 1;
 
 		// Continue tuning from about the current level
-		if(bubbleLevel < 0x0FFF-bubbleLevelMargin) bubbleSensorMax = bubbleLevel + bubbleLevelMargin;
+		if(bubbleLevel < 0x0FFF-BUBBLE_LEVEL_MARGIN) bubbleSensorMax = bubbleLevel + BUBBLE_LEVEL_MARGIN;
 		else bubbleSensorMax = 0x0FFF;
 
-		if(bubbleLevel > bubbleLevelMargin) bubbleSensorMin = bubbleLevel - bubbleLevelMargin;
+		if(bubbleLevel > BUBBLE_LEVEL_MARGIN) bubbleSensorMin = bubbleLevel - BUBBLE_LEVEL_MARGIN;
 		else bubbleSensorMin = 0;
+		quantileSet(&bubbleHigh, bubbleSensorMax);
+		quantileSet(&bubbleLow, bubbleSensorMin);
 	} else {
 		bubbleAutoLevel = 0;
 		bubbleLevel = threshold << 5;
 	}
+	bubbleIdle = 0;								// Known again after the next block
 }
 
 uint16_t bubbleGetCo2Value(void)
@@ -245,6 +504,29 @@ uint8_t bubbleGetCo2Sensor(void)
 	return bubbleCo2LastState;
 }
 
+uint32_t bubbleGetCo2Period(void)
+{
+	return bubbleCo2Period;
+}
+
+/**
+ * One change is one fill of the sensor, so this is the flow in fills.
+ * If the current fill has taken longer than the previous one, the rate
+ * is calculated from the current fill
+ */
+uint16_t bubbleGetCo2Rate(void)
+{
+	uint32_t period = bubbleCo2Period;
+	uint32_t elapsed = getTime() - bubbleCo2Time;
+	uint32_t rate;
+
+	if(!period) return 0;
+	if(elapsed > period) period = elapsed;
+
+	rate = 36000000 / period;								// 0.1 / h
+	return (rate > 0xFFFF) ? 0xFFFF : (uint16_t)rate;
+}
+
 uint8_t bubbleGetAutoLevelMode(void)
 {
 	return bubbleAutoLevel;
@@ -263,4 +545,34 @@ uint16_t bubbleGetSensorMaximum(void)
 uint16_t bubbleGetSensorMinimum(void)
 {
 	return bubbleSensorMin;
+}
+
+void bubbleGetState(bubbleState *state)
+{
+	state->integral = bubbleIntegral;
+	state->count = bubbleEvents.count;
+	state->co2 = bubbleCo2;
+	state->sensorMax = bubbleSensorMax;
+	state->sensorMin = bubbleSensorMin;
+	state->level = bubbleLevel;
+	state->co2LastState = bubbleCo2LastState;
+	state->autoLevel = bubbleAutoLevel;
+}
+
+/**
+ * Continue counting from the state saved before reset
+ */
+void bubbleSetState(const bubbleState *state)
+{
+	bubbleIntegral = state->integral;
+	bubbleEvents.count = state->count;
+	bubbleCo2 = state->co2;
+	bubbleSensorMax = state->sensorMax;
+	bubbleSensorMin = state->sensorMin;
+	quantileSet(&bubbleHigh, bubbleSensorMax);
+	quantileSet(&bubbleLow, bubbleSensorMin);
+	bubbleLevel = state->level;
+	bubbleCo2LastState = state->co2LastState;
+	bubbleAutoLevel = state->autoLevel;
+	bubbleIdle = 0;
 }
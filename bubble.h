@@ -3,14 +3,35 @@
 
 // Library to read LDR and parse it based on ADC value
 
-#define BUBBLE_TIME_INTERVAL		10		// [ms] interval to run
-#define bubbleADCFifoDepth			8		// TODO: Sequence 1 has fifo of 8 samples
+#define BUBBLE_TIME_INTERVAL		10		// [ms] interval to run, i.e. one sample block
+#define BUBBLE_SAMPLE_RATE			1000	// [Hz] ADC0 sequence 0 is triggered by TIMER1, 1 kHz or more
+#define BUBBLE_BLOCK_SIZE			(BUBBLE_SAMPLE_RATE * BUBBLE_TIME_INTERVAL / 1000)	// Samples per uDMA buffer, max 1024
 
-#define BUBBLE_AUTOLEVEL_CYCLES		200		// Every n cycles decrease/increase threshold in auto level mode
+#define BUBBLE_CIC_ORDER			2		// Decimation filter before detection (filter.h)
+#define BUBBLE_CIC_SHIFT			1		// Decimate by 2
+#define BUBBLE_FILTER_RATE			(BUBBLE_SAMPLE_RATE >> BUBBLE_CIC_SHIFT)	// [Hz] Rate of the filtered signal
 
-// Initialize all pins and ports
+// Auto level places the threshold between the low and high percentiles of the signal (quantile.h)
+#define BUBBLE_QUANTILE_LOW			2		// [%]
+#define BUBBLE_QUANTILE_HIGH		98		// [%]
+#define BUBBLE_QUANTILE_STEP		1024	// Estimate step per filtered sample [1/256 ADC], i.e. 4 ADC units
+#define BUBBLE_LEVEL_MARGIN			200		// [ADC] Narrower window between the percentiles has no bubbles
+
+#define BUBBLE_CO2_EVENTS			16		// Hall switch edges waiting for the thread, power of 2
+#define BUBBLE_CO2_DEBOUNCE			5		// [ms] Level must stay this long to count as a change
+
+// Initialize all pins and ports, start sampling
 void bubbleSetup(void);
 
+// ADC0 sequence 0 interrupt, raised when uDMA has filled a buffer
+void bubbleADCIntHandler(void);
+
+// GPIO port D interrupt, raised on both edges of the Hall switch
+void bubbleCo2IntHandler(void);
+
+// Recover after the thread was restarted by the supervisor
+void bubbleRecover(void);
+
 // Returns 1 if data is valid (i.e. conversion not running)
 uint8_t bubbleDataValid();
 // Returns 1 if new data since last reset (value reset)
@@ -23,12 +44,22 @@ uint8_t bubbleGetBubble();
 uint16_t bubbleGetLastValue();
 // Get the value of the integrated bubbling value
 uint32_t bubbleGetIntegral();
+// Get the number of bubbles counted (bubbledetect.h)
+uint32_t bubbleGetCount(void);
+// Get the bubble rate [0.1 / min]
+uint16_t bubbleGetRate(void);
+// Get the length of the latest bubble [ms]
+uint16_t bubbleGetLength(void);
 // Set the threshold level
 void bubbleSetThreshold(uint8_t threshold);
 // Get the co2 production value from the volume sensor
 uint16_t bubbleGetCo2Value(void);
 // Get the latest co2 sensor value
 uint8_t bubbleGetCo2Sensor(void);
+// Get the time between the latest two co2 sensor changes, i.e. one fill [ms], 0 until known
+uint32_t bubbleGetCo2Period(void);
+// Get the co2 sensor changes per hour [0.1 / h], decays when no changes come
+uint16_t bubbleGetCo2Rate(void);
 // Get if automatic mode is on
 uint8_t bubbleGetAutoLevelMode(void);
 // Get bubble level threshold
@@ -38,7 +69,23 @@ uint16_t bubbleGetSensorMaximum(void);
 // Get the minimum signal level
 uint16_t bubbleGetSensorMinimum(void);
 
-// Loop to read ADC sensor and calculate bubbling index
+// Counters and auto level state, kept over warm restarts (warm.h)
+typedef struct _bubbleState {
+	uint32_t integral;
+	uint32_t count;
+	uint16_t co2;
+	uint16_t sensorMax;
+	uint16_t sensorMin;
+	uint16_t level;
+	uint8_t co2LastState;
+	uint8_t autoLevel;
+} bubbleState;
+
+// Copy the state out, or restore it after a warm restart
+void bubbleGetState(bubbleState *state);
+void bubbleSetState(const bubbleState *state);
+
+// Loop to process sample blocks and calculate bubbling index
 PT_THREAD(bubbleLoop(struct pt *pt));
 
 
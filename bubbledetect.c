@@ -0,0 +1,133 @@
+/**
+ * Bubble event detector with hysteresis, see bubbledetect.h
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "bubbledetect.h"
+
+
+void bubbleDetectInit(bubbleDetector *d, uint32_t sampleRate)
+{
+	d->sampleRate = sampleRate ? sampleRate : 1;
+	d->enter = 0;
+	d->leave = 0;
+	d->invert = 0;
+	d->inBubble = 0;
+	d->started = 0;
+	d->pending = 0;
+	d->count = 0;
+	d->time = 0;
+	d->start = 0;
+	d->interval = 0;
+	d->length = 0;
+}
+
+void bubbleDetectSetLevel(bubbleDetector *d, uint16_t level, uint16_t hysteresis, uint8_t invert)
+{
+	uint16_t low, high;
+
+	hysteresis /= 2;
+	low = (level > hysteresis) ? level - hysteresis : 0;
+	high = (level < 0xFFFF - hysteresis) ? level + hysteresis : 0xFFFF;
+
+	d->invert = invert;
+	if(invert) {
+		d->enter = high;
+		d->leave = low;
+	} else {
+		d->enter = low;
+		d->leave = high;
+	}
+}
+
+uint16_t bubbleDetectHysteresis(uint16_t max, uint16_t min)
+{
+	uint16_t hysteresis = (max > min) ? (max - min) / BUBBLE_HYSTERESIS_DIV : 0;
+	return (hysteresis < BUBBLE_HYSTERESIS_MIN) ? BUBBLE_HYSTERESIS_MIN : hysteresis;
+}
+
+// Bubble ended at the current sample, take its length
+static void _bubbleDetectEnd(bubbleDetector *d)
+{
+	uint64_t ms;
+
+	ms = (uint64_t)(d->time - d->start) * 1000 / d->sampleRate;
+	d->length = (ms > 0xFFFF) ? 0xFFFF : (uint16_t)ms;
+	d->inBubble = 0;
+}
+
+/**
+ * Two-state machine: outside a bubble the sample is compared to the enter
+ * level, inside to the leave level. The interval between bubble starts is
+ * averaged, the length is taken when the bubble ends
+ */
+uint8_t bubbleDetectSample(bubbleDetector *d, uint16_t sample)
+{
+	uint32_t elapsed;
+	uint32_t start;
+
+	d->time++;
+
+	if(!d->inBubble) {
+		if((!d->invert && sample <= d->enter) || (d->invert && sample >= d->enter)) {
+			// Count only after BUBBLE_LENGTH_MIN, the bubble started at the first sample past the threshold
+			d->pending++;
+			if((uint32_t)d->pending * 1000 < (uint32_t)BUBBLE_LENGTH_MIN * d->sampleRate) return 0;
+			start = d->time - d->pending + 1;
+			d->pending = 0;
+
+			// Interval is known from the second bubble on
+			elapsed = start - d->start;
+			if(d->started && !d->interval)
+				d->interval = elapsed;
+			else if(d->started)
+				d->interval = d->interval - (d->interval >> BUBBLE_RATE_SHIFT) + (elapsed >> BUBBLE_RATE_SHIFT);
+
+			d->start = start;
+			d->started = 1;
+			d->count++;
+			d->inBubble = 1;
+			return 1;
+		}
+		d->pending = 0;
+	} else if((!d->invert && sample >= d->leave) || (d->invert && sample <= d->leave)) {
+		_bubbleDetectEnd(d);
+	}
+
+	return 0;
+}
+
+/**
+ * Samples without bubbles, e.g. an idle airlock. Time keeps running so the
+ * rate decays, a bubble in progress ends at the first of them
+ */
+void bubbleDetectIdle(bubbleDetector *d, uint32_t samples)
+{
+	if(!samples) return;
+
+	d->pending = 0;
+	d->time++;
+	if(d->inBubble) _bubbleDetectEnd(d);
+	d->time += samples - 1;
+}
+
+/**
+ * Rate from the average interval, or from the time since the latest
+ * bubble if that is already longer, so the rate falls when bubbling stops
+ */
+uint16_t bubbleDetectGetRate(const bubbleDetector *d)
+{
+	uint32_t interval = d->interval;
+	uint32_t elapsed = d->time - d->start;
+	uint32_t rate;
+
+	if(!interval) return 0;
+	if(elapsed > interval) interval = elapsed;
+
+	rate = (600 * d->sampleRate) / interval;				// 0.1 / min
+	return (rate > 0xFFFF) ? 0xFFFF : (uint16_t)rate;
+}
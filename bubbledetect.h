@@ -0,0 +1,57 @@
+#ifndef __BUBBLEDETECT_H__
+#define __BUBBLEDETECT_H__
+
+// Bubble event detector
+//
+// Counts discrete bubbles from the airlock sensor samples instead of the
+// time spent under the threshold. A bubble starts when the signal crosses
+// the threshold by half of the hysteresis and ends when it comes back past
+// the other side, so noise around the threshold does not split one bubble
+// into many. The signal must stay past the threshold for BUBBLE_LENGTH_MIN
+// before the bubble is counted, so short noise spikes that get through the
+// filter are not counted. The length of every bubble is measured and the
+// rate is kept as an exponential average of the time between bubble starts.
+//
+// No hardware access, time is counted in samples, so the detector can be
+// fed with recorded samples on the host as well.
+
+#define BUBBLE_HYSTERESIS_MIN		16				// [ADC] Smallest hysteresis between the two thresholds
+#define BUBBLE_HYSTERESIS_DIV		8				// Hysteresis is 1/8 of the sensor min...max window
+#define BUBBLE_RATE_SHIFT			3				// Rate average weight of a new interval 1/2^n
+#define BUBBLE_LENGTH_MIN			10				// [ms] Shorter crossings of the threshold are not bubbles
+
+// Detector state
+typedef struct _bubbleDetector {
+	uint32_t sampleRate;					// [Hz]
+	uint16_t enter;							// Bubble starts past this level
+	uint16_t leave;							// and ends when back past this one
+	uint8_t invert;							// Bubble is above the threshold
+	uint8_t inBubble;
+	uint8_t started;						// A bubble has started since init, i.e. start is valid
+	uint16_t pending;						// Samples past the threshold, not yet counted as a bubble
+	uint32_t count;							// Bubbles since reset, kept over warm restarts
+	uint32_t time;							// Samples since reset, wraps
+	uint32_t start;							// Time of the latest bubble start [samples]
+	uint32_t interval;						// Average time between bubble starts [samples], 0 until known
+	uint16_t length;						// Length of the latest complete bubble [ms]
+} bubbleDetector;
+
+// Reset the detector and its counters
+void bubbleDetectInit(bubbleDetector *d, uint32_t sampleRate);
+
+// Set the thresholds around level, bubble is under the level unless inverted
+void bubbleDetectSetLevel(bubbleDetector *d, uint16_t level, uint16_t hysteresis, uint8_t invert);
+
+// Hysteresis for the sensor signal window max...min
+uint16_t bubbleDetectHysteresis(uint16_t max, uint16_t min);
+
+// Process one sample, returns 1 if a bubble was counted (BUBBLE_LENGTH_MIN after its start)
+uint8_t bubbleDetectSample(bubbleDetector *d, uint16_t sample);
+
+// Skip samples that cannot contain bubbles, ends a bubble in progress
+void bubbleDetectIdle(bubbleDetector *d, uint32_t samples);
+
+// Bubbles per minute [0.1 /min], decays when no bubbles come
+uint16_t bubbleDetectGetRate(const bubbleDetector *d);
+
+#endif
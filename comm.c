@@ -12,9 +12,17 @@ typedef uint8_t bool;
 
 #include "pt.h"
 #include "common.h"
+#include "sched.h"
+#include "resource.h"
+#include "profile.h"
+#include "trace.h"
 #include "eeprom.h"
+#include "bubble.h"
 #include "nrf24l01.h"
 #include "comm.h"
+#include "boot.h"
+#include "power.h"
+#include "warm.h"
 
 
 // From main.c
@@ -25,7 +33,7 @@ extern eData previousData;
 extern uint16_t bubbleRawValue;
 extern uint8_t newDataFlags;
 
-extern uint32_t *storeTimer;
+extern threadTimer *storeTimer;
 
 
 // Serial port communication buffers
@@ -38,10 +46,11 @@ static const uint64_t pipes[2] = { 0xF0F0F0F0E1LL, 0xF0F0F0F0D2LL };
 
 
 // Timers
-static uint32_t *uartTimer;
-static uint32_t *rfTimer;
+static threadTimer *uartTimer;
+static threadTimer *rfTimer;
 static uint16_t rfDataTimer = 0;
 static uint16_t rfConfigTimer = 0;
+static resourceTicket rfSSITicket;							// Place in SSI0 queue
 
 
 // Handler for UART receive interrupt
@@ -51,6 +60,9 @@ void __attribute__ ((interrupt)) UARTIntHandler(void)
 	long lChar;
 	uint8_t ucChar;
 
+	// Time of the receive is not known, only duration is measured
+	PROFILE_ISR_ENTER(PROFILE_ISR_NO_LATENCY);
+
 	// Get and clear the current interrupt source(s)
 	ulInts = UARTIntStatus(UART0_BASE, ~0);
 	UARTIntClear(UART0_BASE, ulInts);
@@ -72,7 +84,9 @@ void __attribute__ ((interrupt)) UARTIntHandler(void)
 			// If the character did not contain any error notifications, copy it to the output buffer.
 			if(!(lChar & ~0xFF)) {
 				ucChar = lChar & 0xFF;
+				TRACE_EVENT(TRACE_ISR_UART, ucChar);
 				ledStatus ^= LED_GREEN;
+				schedSignal(SCHED_EV_UART);
 
 				UARTCharPutNonBlocking(UART0_BASE, ucChar);		// Echo back
 
@@ -84,6 +98,8 @@ void __attribute__ ((interrupt)) UARTIntHandler(void)
 			}
 		}
 	}
+
+	PROFILE_ISR_EXIT(PROFILE_ISR_UART);
 }
 
 
@@ -175,7 +191,7 @@ void serialCommSetup(void)
 	}
 
 	GPIOPinTypeUART(GPIO_PORTA_BASE, GPIO_PIN_0 | GPIO_PIN_1);
-	UARTConfigSetExpClk(UART0_BASE, SysCtlClockGet(), 115200,
+	UARTConfigSetExpClk(UART0_BASE, SYSTEM_CLOCK, 115200,
 							(UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE |
 							 UART_CONFIG_PAR_NONE));
 	UARTIntRegister(UART0_BASE, UARTIntHandler);
@@ -184,7 +200,7 @@ void serialCommSetup(void)
 	// Set the timer
 	uartTimer = getFreeTimer();
 	if(uartTimer)
-		*uartTimer = COMM_INTERVAL;
+		timerStart(uartTimer, COMM_INTERVAL);
 }
 
 PT_THREAD(commLoop(struct pt *pt))
@@ -195,6 +211,27 @@ PT_THREAD(commLoop(struct pt *pt))
 
 	static uint32_t dumpData = 0;
 	static uint16_t dumpAddr = 0;
+	static uint8_t resNum = 0;
+	static uint8_t perNum = 0;
+	static periodicTimer *period;
+	static uint8_t taskNum = 0;
+	static uint8_t powerNum = 0;
+#ifdef PROFILE
+	static uint8_t profNum = 0;
+	static profileCounter *profCounter;
+	static profilePinCost pinCost;
+#endif
+#ifdef PROFILE_ISR
+	static uint8_t isrNum = 0;
+	static uint8_t isrBin = 0;
+	static profileIsrHistogram *isrHist;
+#endif
+#ifdef TRACE
+	static uint16_t traceNum = 0;
+	static uint16_t traceIdx = 0;
+	static uint32_t traceCycles;
+	static uint32_t traceUs;
+#endif
 
 	// Trim newlines
 	while(readPos != writePos && (rxBuffer[readPos] == '\r' || rxBuffer[readPos] == '\n')) readPos = (readPos + 1) & RXBUFFERSIZE;
@@ -218,11 +255,13 @@ PT_THREAD(commLoop(struct pt *pt))
 					if(bytes < 4) break;
 					systemConfig.bubbleLevel = rxGetInt(1, 3);
 					bubbleSetThreshold(systemConfig.bubbleLevel);
+					warmChanged();
 					handled = 4;
 				} else if(command == 's') {  // Eeprom store interval, sXX, where XX is interval in minutes (decimal)'
 					if(bytes < 3) break;
 					systemConfig.storeInterval = rxGetInt(1, 2);
 					if(systemConfig.storeInterval == 0) systemConfig.storeInterval = 1;
+					warmChanged();
 					handled = 3;
 				} else if(command == 'c') { // Print out config word
 					PT_WAIT_UNTIL(pt, UARTSendHex(systemConfig.flags));
@@ -262,11 +301,193 @@ PT_THREAD(commLoop(struct pt *pt))
 				} if(command == 'f') {	// Set configuration flags
 					if(bytes < 4) break;
 					systemConfig.flags = rxGetInt(1, 3);
+					warmChanged();
 					
 					if(systemConfig.flags & CONF_BUBBLE_AUTOLEVEL) bubbleSetThreshold(0);
 					else bubbleSetThreshold(systemConfig.bubbleLevel);
 						
 					handled = 4;
+				} else if(command == 'a') {	// Print resource arbitration statistics
+					for(resNum = 0; resNum < RESOURCES; resNum++) {
+						PT_WAIT_UNTIL(pt, UARTSend("A", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(resNum));
+						PT_WAIT_UNTIL(pt, UARTSend(":", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(resources[resNum].grants));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(resources[resNum].maxWaiting));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(resources[resNum].waitMax));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(resources[resNum].waitTotal));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					}
+					handled = 1;
+				} else if(command == 'g') {	// Print release jitter statistics of periodic threads
+					for(perNum = 0; perNum < PERIODIC_TIMERS; perNum++) {
+						period = getPeriodic(perNum);
+						if(!period) continue;
+
+						PT_WAIT_UNTIL(pt, UARTSend("G", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(perNum));
+						PT_WAIT_UNTIL(pt, UARTSend(":", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(period->releases));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(period->overruns));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(period->jitterMax));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(period->jitterTotal));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					}
+					handled = 1;
+				} else if(command == 'v') {	// Print supervisor restarts of threads
+					for(taskNum = 0; taskNum < SCHED_TASKS; taskNum++) {
+						PT_WAIT_UNTIL(pt, UARTSend("V", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(taskNum));
+						PT_WAIT_UNTIL(pt, UARTSend(":", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(schedGetRestarts(taskNum)));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					}
+					handled = 1;
+				} else if(command == 'm') {	// Print static RAM and stack use
+					PT_WAIT_UNTIL(pt, UARTSend("M:", 2));
+					PT_WAIT_UNTIL(pt, UARTSendInt(ramGetStatic()));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(stackGetUsed()));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(stackGetFree()));
+					PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					handled = 1;
+				} else if(command == 'u') {	// Print power states, UN:state,sleep,idle,active [ms],charge [uAh]
+					for(powerNum = 0; powerNum < POWER_SUBSYSTEMS; powerNum++) {
+						PT_WAIT_UNTIL(pt, UARTSend("U", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(powerNum));
+						PT_WAIT_UNTIL(pt, UARTSend(":", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(powerGetState(powerNum)));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(powerGetTime(powerNum, POWER_SLEEP)));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(powerGetTime(powerNum, POWER_IDLE)));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(powerGetTime(powerNum, POWER_ACTIVE)));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(powerGetCharge(powerNum)));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					}
+					handled = 1;
+				} else if(command == 'k') {	// Timed function wait policy, kX, 0=auto, 1=always spin, 2=always timer
+					if(bytes < 2) break;
+					timedSetSpinPolicy(rxGetInt(1, 1));
+					PT_WAIT_UNTIL(pt, UARTSend("T", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(timedSpinLimit));
+					PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					handled = 2;
+#ifdef PROFILE
+				} else if(command == 'i') {	// Print profiling counters, threads (P) and timed functions (Q)
+					for(profNum = 0; profNum < PROFILE_THREADS + PROFILE_TIMED; profNum++) {
+						if(profNum < PROFILE_THREADS) profCounter = profileGetThread(profNum);
+						else profCounter = profileGetTimed(profNum - PROFILE_THREADS);
+						if(!profCounter) continue;
+
+						if(profNum < PROFILE_THREADS) {
+							PT_WAIT_UNTIL(pt, UARTSend("P", 1));
+							PT_WAIT_UNTIL(pt, UARTSendInt(profNum));
+						} else {
+							PT_WAIT_UNTIL(pt, UARTSend("Q", 1));
+							PT_WAIT_UNTIL(pt, UARTSendInt(profNum - PROFILE_THREADS));
+						}
+						PT_WAIT_UNTIL(pt, UARTSend(":", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(profCounter->runs));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(profCounter->idleRuns));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt((uint32_t)(profCounter->cycles / CLOCKS_IN_US)));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(profCounter->minCycles));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(profCounter->maxCycles));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					}
+					for(profNum = 0; profNum < 2; profNum++) {
+						PT_WAIT_UNTIL(pt, UARTSend("W", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(profNum));
+						PT_WAIT_UNTIL(pt, UARTSend(":", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(profileGetWait(profNum)->waits));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(profileGetWait(profNum)->errorTotal));
+						PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(profileGetWait(profNum)->errorMax));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					}
+					PT_WAIT_UNTIL(pt, UARTSend("I", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(profileGetIdlePercent()));
+					PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					handled = 1;
+				} else if(command == 'e') {	// Measure cost of pin accesses, driverlib vs direct
+					profilePins(GPIO_PORTB_BASE, &pinCost);		// Port of the bit-banged sensors
+					PT_WAIT_UNTIL(pt, UARTSend("E:", 2));
+					PT_WAIT_UNTIL(pt, UARTSendInt(pinCost.libWrite));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(pinCost.pinWrite));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(pinCost.libRead));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(pinCost.pinRead));
+					PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					handled = 1;
+				} else if(command == 'j') {	// Clear profiling counters
+					profileReset();
+					PT_WAIT_UNTIL(pt, UARTSend("K\r\n", 3));
+					handled = 1;
+#endif
+#ifdef PROFILE_ISR
+				} else if(command == 'h') {	// Print and clear interrupt latency (L) and duration (D) histograms
+					for(isrNum = 0; isrNum < PROFILE_ISRS; isrNum++) {
+						isrHist = profileGetIsr(isrNum);
+
+						PT_WAIT_UNTIL(pt, UARTSend("H", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(isrNum));
+						PT_WAIT_UNTIL(pt, UARTSend("L:", 2));
+						for(isrBin = 0; isrBin < PROFILE_ISR_BINS; isrBin++) {
+							PT_WAIT_UNTIL(pt, UARTSendInt(isrHist->latency[isrBin]));
+							PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						}
+						PT_WAIT_UNTIL(pt, UARTSendInt(isrHist->maxLatency));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+
+						PT_WAIT_UNTIL(pt, UARTSend("H", 1));
+						PT_WAIT_UNTIL(pt, UARTSendInt(isrNum));
+						PT_WAIT_UNTIL(pt, UARTSend("D:", 2));
+						for(isrBin = 0; isrBin < PROFILE_ISR_BINS; isrBin++) {
+							PT_WAIT_UNTIL(pt, UARTSendInt(isrHist->duration[isrBin]));
+							PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+						}
+						PT_WAIT_UNTIL(pt, UARTSendInt(isrHist->maxDuration));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					}
+					profileIsrReset();
+					handled = 1;
+#endif
+#ifdef TRACE
+				} else if(command == 't') {	// Read out the event trace, Z<lost><cycles><us> and X<time><id><arg> per event
+					traceNum = traceFreeze();
+					traceCycles = (uint32_t)getCycles();
+					traceUs = (uint32_t)getTimeUs();
+					PT_WAIT_UNTIL(pt, UARTSend("Z", 1));
+					PT_WAIT_UNTIL(pt, UARTSendHex(traceGetLost()));
+					PT_WAIT_UNTIL(pt, UARTSendHex(traceCycles));
+					PT_WAIT_UNTIL(pt, UARTSendHex(traceUs));
+					PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					for(traceIdx = 0; traceIdx < traceNum && traceGet(traceIdx); traceIdx++) {
+						PT_WAIT_UNTIL(pt, UARTSend("X", 1));
+						PT_WAIT_UNTIL(pt, UARTSendHex(traceGet(traceIdx)->time));
+						PT_WAIT_UNTIL(pt, UARTSendHex(((uint32_t)traceGet(traceIdx)->id << 16) | traceGet(traceIdx)->arg));
+						PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					}
+					PT_WAIT_UNTIL(pt, UARTSend("K\r\n", 3));
+					traceResume();
+					handled = 1;
+#endif
 				} else {
 					// Get rid of unknown characters...
 					while(readPos != writePos) readPos = (readPos + 1) & RXBUFFERSIZE;
@@ -280,8 +501,8 @@ PT_THREAD(commLoop(struct pt *pt))
 
 		// Communications running with timer
 		// Doing this in while loop so that we can break out easily
-		while(uartTimer && !(*uartTimer)) {
-			*uartTimer = COMM_INTERVAL;
+		while(uartTimer && timerExpired(uartTimer)) {
+			timerStart(uartTimer, COMM_INTERVAL);
 
 			if(!(systemConfig.flags & CONF_SEND_UART)) break;
 
@@ -317,9 +538,23 @@ PT_THREAD(commLoop(struct pt *pt))
 					PT_WAIT_UNTIL(pt, UARTSendInt(bubbleGetCo2Sensor()));
 					PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
 				}
+				if(latestData.bubbles != previousData.bubbles && (systemConfig.flags & CONF_ECHO_BINTEGRAL)) {
+					PT_WAIT_UNTIL(pt, UARTSend("N", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(latestData.bubbles));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(latestData.bubbleRate));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(latestData.bubbleLength));
+					PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
+					previousData.bubbles = latestData.bubbles;
+				}
 				if(latestData.co2 != previousData.co2) {
 					PT_WAIT_UNTIL(pt, UARTSend("C", 1));
 					PT_WAIT_UNTIL(pt, UARTSendInt(latestData.co2));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(bubbleGetCo2Period()));
+					PT_WAIT_UNTIL(pt, UARTSend(",", 1));
+					PT_WAIT_UNTIL(pt, UARTSendInt(bubbleGetCo2Rate()));
 					PT_WAIT_UNTIL(pt, UARTSend("\r\n", 2));
 					previousData.co2 = latestData.co2;
 				}
@@ -345,20 +580,17 @@ PT_THREAD(commLoop(struct pt *pt))
 			}
 		}
 
-		PT_YIELD(pt);
+		// Continue on next received character or when it is time to print again
+		SCHED_YIELD_WAIT(pt, uartTimer, SCHED_EV_UART);
 	}
 
 	PT_END(pt);
 }
 
 
-void rfCommSetup(void)
+// Initialize the radio module and its pipes
+static void _rfRadioInit(void)
 {
-	// Initialize the timer
-	rfTimer = getFreeTimer();
-	if(rfTimer)
-		*rfTimer = RF_PING_INTERVAL;
-	
 	// Initialize the radio module
 	rf24Setup();
 
@@ -377,6 +609,29 @@ void rfCommSetup(void)
 	//rf24StartListening();
 
 	rf24PowerUp();
+	powerSetState(POWER_RADIO, POWER_IDLE);
+
+	// Thread starts sending when the radio has powered up
+	if(rfTimer)
+		timerStart(rfTimer, RF24_POWERUP_TIME);
+}
+
+void rfCommSetup(void)
+{
+	// Initialize the timer
+	rfTimer = getFreeTimer();
+	
+	_rfRadioInit();
+}
+
+/**
+ * Thread was restarted by the supervisor, e.g. radio never finished sending
+ * SSI0 is given back and the radio initialized again (no other SSI0 users)
+ */
+void rfCommRecover(void)
+{
+	resourceCancel(&resources[RESOURCE_SSI], &rfSSITicket);
+	_rfRadioInit();
 }
 
 /**
@@ -405,6 +660,18 @@ void nibble2hex(uint8_t dec, uint8_t *buf)
 	else *buf = dec - 10 + 'A';
 }
 
+/**
+ * Write a 4 byte value to hex to buf...buf+7, returns pointer after it
+ */
+uint8_t *int2hex(uint32_t value, uint8_t *buf)
+{
+	dec2hex((value >> 24) & 0xFF, buf++); buf++;
+	dec2hex((value >> 16) & 0xFF, buf++); buf++;
+	dec2hex((value >> 8) & 0xFF, buf++); buf++;
+	dec2hex(value & 0xFF, buf++); buf++;
+	return buf;
+}
+
 /**
  * Create a data packet from all sensor data to send over air
  */
@@ -429,10 +696,25 @@ uint8_t *serializeData(eData *data, uint8_t *buf)
 	return buf;
 }
 
+/**
+ * Create a bubble event packet, does not fit in the data packet
+ */
+uint8_t *serializeBubbles(eData *data, uint8_t *buf)
+{
+	buf = int2hex(data->bubbles, buf);
+	dec2hex((data->bubbleRate >> 8) & 0xFF, buf++); buf++;
+	dec2hex(data->bubbleRate & 0xFF, buf++); buf++;
+	dec2hex((data->bubbleLength >> 8) & 0xFF, buf++); buf++;
+	dec2hex(data->bubbleLength & 0xFF, buf++); buf++;
+	dec2hex(data->n & 0xFF, buf++); buf++;
+	return buf;
+}
+
 
 PT_THREAD(rfCommLoop(struct pt *pt))
 {
 	uint16_t temp;
+	uint32_t temp32;
 	static uint8_t mode = RF_MODE_PING;			// Start in PING mode
 	static uint8_t status = 0;
 	static uint8_t errorCount = 0;
@@ -440,14 +722,59 @@ PT_THREAD(rfCommLoop(struct pt *pt))
 	static uint8_t receivePayload[32] = {0};
 	static uint8_t len, more;
 	static uint8_t blockNum = 0;
+	static uint8_t dumpStage = 0;
 	static eData data;
 	static uint8_t flags;
+#ifdef PROFILE
+	static uint8_t profNum = 0;
+	static uint8_t profStage = 0;
+	profileCounter *counter;
+#endif
+#ifdef TRACE
+	static uint16_t traceNum = 0;
+	static uint16_t traceIdx = 0;
+	static uint8_t traceHeader = 0;
+	static uint8_t traceReading = 0;				// Trace is frozen for this thread
+	const traceEvent *event;
+#endif
+	static uint8_t tracedMode = 0;
+	static uint32_t rfWakeTime;
 	uint8_t i;
 	
 	PT_BEGIN(pt);
+
+	// Wait for power up without blocking
+	if(rfTimer) {
+		SCHED_WAIT_TIMER(pt, rfTimer);
+		timerStart(rfTimer, RF_PING_INTERVAL);
+	}
 	
 	while(1)
 	{
+		// Mode changes are traced once per round
+		if(mode != tracedMode) {
+			TRACE_EVENT(TRACE_RF_MODE, mode);
+			tracedMode = mode;
+		}
+#ifdef TRACE
+		// Read out finished or was interrupted by another mode
+		if(traceReading && mode != RF_MODE_TRACE) {
+			traceResume();
+			traceReading = 0;
+		}
+#endif
+
+		// Radio is accessed through SSI0 until the wait below
+		RESOURCE_ACQUIRE(pt, &resources[RESOURCE_SSI], &rfSSITicket);
+
+		// Radio was powered down between rounds, standby is reached after RF24_POWERUP_TIME
+		if(powerGetState(POWER_RADIO) == POWER_SLEEP) {
+			rf24PowerUp();
+			powerSetState(POWER_RADIO, POWER_IDLE);
+			rfWakeTime = getTime() + RF24_POWERUP_TIME + 1;		// Next tick may come right away
+			SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TICK, TIME_AFTER_EQ(getTime(), rfWakeTime));
+		}
+
 		i = 0;
 		if(mode == RF_MODE_DATA)
 		{
@@ -475,9 +802,14 @@ PT_THREAD(rfCommLoop(struct pt *pt))
 				sendPayload[i++] = 'D';
 				i = serializeData(&latestData, &sendPayload[i]) - sendPayload;
 				newDataFlags &= 0xF0;			// Clear lower 4 bits that were sent
-				mode = RF_MODE_CONFIG;			// Send config right after data
+				mode = RF_MODE_BUBBLES;			// Send bubble events and config right after data
 			}
 
+		} else if(mode == RF_MODE_BUBBLES) {
+			sendPayload[i++] = 'N';
+			i = serializeBubbles(&latestData, &sendPayload[i]) - sendPayload;
+			mode = RF_MODE_CONFIG;
+
 		} else if(mode == RF_MODE_CONFIG) {
 			// Config data
 			sendPayload[i++] = 'C';
@@ -491,19 +823,25 @@ PT_THREAD(rfCommLoop(struct pt *pt))
 			
 			if(storeTimer)
 			{
-				dec2hex(((*storeTimer) >> 24) & 0xFF, &sendPayload[i++]); i++;
-				dec2hex(((*storeTimer) >> 16) & 0xFF, &sendPayload[i++]); i++;
-				dec2hex(((*storeTimer) >> 8) & 0xFF, &sendPayload[i++]); i++;
-				dec2hex((*storeTimer) & 0xFF, &sendPayload[i++]); i++;
+				temp32 = timerRemaining(storeTimer);
+				dec2hex((temp32 >> 24) & 0xFF, &sendPayload[i++]); i++;
+				dec2hex((temp32 >> 16) & 0xFF, &sendPayload[i++]); i++;
+				dec2hex((temp32 >> 8) & 0xFF, &sendPayload[i++]); i++;
+				dec2hex(temp32 & 0xFF, &sendPayload[i++]); i++;
 			}
 			
 			mode = RF_MODE_DONE;						// Back to data mode after one config send
 		} else if(mode == RF_MODE_DUMP) {
-			// Dump contents of EEPROM
-			if(blockNum < eGetNumBlocks() && !eReadData(&data, blockNum++)) {
+			// Dump contents of EEPROM, E and N packet per block
+			if(dumpStage) {
+				sendPayload[i++] = 'N';
+				i = serializeBubbles(&data, &sendPayload[i]) - sendPayload;
+				dumpStage = 0;
+			} else if(blockNum < eGetNumBlocks() && !eReadData(&data, blockNum++)) {
 				// Successfull read from eeprom
 				sendPayload[i++] = 'E';
 				i = serializeData(&data, &sendPayload[i]) - sendPayload;
+				dumpStage = 1;
 			} else {
 				// Read was unsuccesfull -> last block maybe?
 				blockNum = 0;
@@ -515,6 +853,58 @@ PT_THREAD(rfCommLoop(struct pt *pt))
 			else
 				sendPayload[i++] = 'F';
 			mode = RF_MODE_DONE;
+#ifdef PROFILE
+		} else if(mode == RF_MODE_PROFILE) {
+			// Profiling counters, threads first and then timed functions
+			// Two packets per counter: I<n><runs><idle runs><total us>, J<n><min><max> (cycles)
+			counter = 0;
+			while(profNum < PROFILE_THREADS + PROFILE_TIMED && !counter) {
+				if(profNum < PROFILE_THREADS) counter = profileGetThread(profNum);
+				else counter = profileGetTimed(profNum - PROFILE_THREADS);
+				if(!counter) profNum++;
+			}
+
+			if(counter && !profStage) {
+				sendPayload[i++] = 'I';
+				dec2hex(profNum, &sendPayload[i++]); i++;
+				i = int2hex(counter->runs, &sendPayload[i]) - sendPayload;
+				i = int2hex(counter->idleRuns, &sendPayload[i]) - sendPayload;
+				i = int2hex((uint32_t)(counter->cycles / CLOCKS_IN_US), &sendPayload[i]) - sendPayload;
+				profStage = 1;
+			} else if(counter) {
+				sendPayload[i++] = 'J';
+				dec2hex(profNum, &sendPayload[i++]); i++;
+				i = int2hex(counter->minCycles, &sendPayload[i]) - sendPayload;
+				i = int2hex(counter->maxCycles, &sendPayload[i]) - sendPayload;
+				profStage = 0;
+				profNum++;
+			} else {
+				// Percentage of time spent sleeping ends the list
+				sendPayload[i++] = 'I';
+				dec2hex(0xFF, &sendPayload[i++]); i++;
+				dec2hex(profileGetIdlePercent(), &sendPayload[i++]); i++;
+				profNum = 0;
+				mode = RF_MODE_DONE;
+			}
+#endif
+#ifdef TRACE
+		} else if(mode == RF_MODE_TRACE) {
+			// Event trace, same records as on UART: Z<lost><cycles><us> header and X<time><id><arg> per event
+			if(traceHeader) {
+				sendPayload[i++] = 'Z';
+				i = int2hex(traceGetLost(), &sendPayload[i]) - sendPayload;
+				i = int2hex((uint32_t)getCycles(), &sendPayload[i]) - sendPayload;
+				i = int2hex((uint32_t)getTimeUs(), &sendPayload[i]) - sendPayload;
+				traceHeader = 0;
+			} else if(traceIdx < traceNum && (event = traceGet(traceIdx)) != 0) {
+				traceIdx++;
+				sendPayload[i++] = 'X';
+				i = int2hex(event->time, &sendPayload[i]) - sendPayload;
+				i = int2hex(((uint32_t)event->id << 16) | event->arg, &sendPayload[i]) - sendPayload;
+			} else {
+				mode = RF_MODE_DONE;							// Trace is resumed on the next round
+			}
+#endif
 		} else if(mode == RF_MODE_ACK) {
 			sendPayload[i++] = 'A';
 			mode = RF_MODE_DATA;
@@ -528,19 +918,20 @@ PT_THREAD(rfCommLoop(struct pt *pt))
 		
 		// Send the packet if there is some payload
 		if(i) {
+			powerSetState(POWER_RADIO, POWER_ACTIVE);
 			rf24Write(sendPayload, i);
 		
-			// Check transmit status
-			do {
-				status = rf24TransmitStatus();
-				PT_YIELD(pt);
-			} while(status == RF24_TX_BUSY);
+			// Check transmit status once every tick
+			SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TICK, (status = rf24TransmitStatus()) != RF24_TX_BUSY);
+			powerSetState(POWER_RADIO, POWER_IDLE);
+			TRACE_EVENT(TRACE_RF_TX, (sendPayload[0] << 8) | status);
 		
 			// If transmission fails, increase error counter
 			if(status == RF24_TX_FAIL && errorCount < 0xFF) {	// Counter saturates
 				errorCount++;
 			} else if(status == RF24_TX_OK) {
 				errorCount = 0;									// Clear when ACK received
+				bootMark(BOOT_FIRST_RF);
 			}
 		}
 
@@ -549,31 +940,59 @@ PT_THREAD(rfCommLoop(struct pt *pt))
 			do {
 				len = rf24GetPayloadSize();
 				more = rf24Read(receivePayload, len);
+				TRACE_EVENT(TRACE_RF_RX, receivePayload[0]);
 
 				// TODO: Handle received message
 				if(receivePayload[0] == 'c') mode = RF_MODE_CONFIG;
 				else if(receivePayload[0] == 'd') mode = RF_MODE_DUMP;
 				else if(receivePayload[0] == 'w') mode = RF_MODE_WRITECONF;
+#ifdef PROFILE
+				else if(receivePayload[0] == 'i') {
+					profNum = 0;
+					profStage = 0;
+					mode = RF_MODE_PROFILE;
+				}
+#endif
+#ifdef TRACE
+				else if(receivePayload[0] == 't') {
+					if(!traceReading) traceNum = traceFreeze();	// A repeated 't' restarts the same read out
+					traceReading = 1;
+					traceIdx = 0;
+					traceHeader = 1;
+					mode = RF_MODE_TRACE;
+				}
+#endif
 				else if(receivePayload[0] == 'f') {
 					i = (receivePayload[1] - '0') * 100;
 					i += (receivePayload[2] - '0') * 10;
 					i += (receivePayload[3] - '0');
 					systemConfig.flags = i;
+					warmChanged();
 				}
 				PT_YIELD(pt);
 			} while(more);										// Read until RX_EMPTY
 		}
-		
+
+		// Power the radio down until the next round if it is far enough,
+		// replies come only as ACK payloads while sending
+		if(rfTimer) {
+			powerSetNext(POWER_RADIO, rfTimer->deadline);
+			if(powerSleepWorth(POWER_RADIO)) {
+				rf24PowerDown();
+				powerSetState(POWER_RADIO, POWER_SLEEP);
+			}
+		}
+		RESOURCE_RELEASE(&resources[RESOURCE_SSI], &rfSSITicket);
 
 		// Wait
-		while(rfTimer && (*rfTimer))
-			PT_YIELD(pt);
+		if(rfTimer)
+			SCHED_WAIT_TIMER(pt, rfTimer);
 
 		if(errorCount > RF_ERROR_LEVEL) {
-			if(rfTimer) *rfTimer = RF_PING_INTERVAL;
+			if(rfTimer) timerStart(rfTimer, RF_PING_INTERVAL);
 			mode = RF_MODE_PING;		// Ping mode
 		} else {
-			if(rfTimer) *rfTimer = RF_COMM_INTERVAL;
+			if(rfTimer) timerStart(rfTimer, RF_COMM_INTERVAL);
 			if(mode == RF_MODE_PING) mode = RF_MODE_DATA;
 		}
 	}
@@ -13,8 +13,11 @@
 
 #define RF_MODE_DATA				1
 #define RF_MODE_CONFIG				2
+#define RF_MODE_BUBBLES				3				// Bubble events, sent after the data packet
 #define RF_MODE_DUMP				10
 #define RF_MODE_WRITECONF			11
+#define RF_MODE_PROFILE				12				// Send profiling counters (PROFILE builds)
+#define RF_MODE_TRACE				13				// Send the event trace (TRACE builds)
 #define RF_MODE_ACK					80				// Confirm command received
 #define RF_MODE_DONE				90				// Confirm end of multiline message
 #define RF_MODE_PING				100
@@ -29,6 +32,7 @@ PT_THREAD(commLoop(struct pt *pt));
 
 // RF communications
 void rfCommSetup(void);
+void rfCommRecover(void);
 PT_THREAD(rfCommLoop(struct pt *pt));
 
 
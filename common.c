@@ -9,146 +9,501 @@ typedef uint8_t bool;
 #include "driverlib/rom_map.h"
 #include "driverlib/rom.h"
 #include "driverlib/timer.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/watchdog.h"
+
+#include "pt.h"
 
 #include "common.h"
+#include "sched.h"
+#include "resource.h"
+#include "profile.h"
+#include "trace.h"
 #include "inc/hw_gpio.h"
 #include "driverlib/gpio.h"
 
 
 // Thread timer variables
 static uint8_t nextTimer = 0;
-static uint32_t commonTimer[TIMERS] = {0};
-static volatile timerCallback timerCb[TIMER_CALLBACKS] = {0};
+static threadTimer commonTimer[TIMERS] = {0};
+static threadTimer *pendingTimers = 0;						// Running timers, earliest deadline first
+static uint8_t nextPeriodic = 0;
+static periodicTimer periodicTimers[PERIODIC_TIMERS] = {0};
+
+// System time in ms, only written in the system timer interrupt
+static volatile uint32_t sysTime = 0;
 
-// Timer helper variables
-static volatile uint8_t timerTriggered = 0;
-static volatile uint8_t timerLatencyError = 255;			// Timer triggered before it was handled (will decrease on error)
 
+// Spin limit of TIMER_WAIT [us], 0 until calibrated
+uint32_t timedSpinLimit = 0;
+static uint32_t timedSpinCalibrated = 0;
+static volatile uint32_t timedCalibrateCycles = 0;
 
 // These are left as globals for now
-volatile uint8_t waitMutex;		// Lock for the exact wait timer
-volatile timerCallback waitCb;	// Callback for exact waitCb
+volatile uint8_t waitMutex[EXACT_TIMERS];		// Locks for the exact wait timers
+volatile timerCallback waitCb[EXACT_TIMERS];	// Callbacks for exact wait timers
+
+// Hardware timers used as exact timers, all in 32-bit one-shot mode
+// TIMER1 is the bubble sensor sample clock (bubble.c), WTIMER0 the timebase
+static const uint32_t exactTimerPeripheral[EXACT_TIMERS] = {
+	SYSCTL_PERIPH_TIMER0, SYSCTL_PERIPH_TIMER2, SYSCTL_PERIPH_TIMER3, SYSCTL_PERIPH_TIMER4, SYSCTL_PERIPH_TIMER5 };
+static const uint32_t exactTimerBase[EXACT_TIMERS] = {
+	TIMER0_BASE, TIMER2_BASE, TIMER3_BASE, TIMER4_BASE, TIMER5_BASE };
+static const uint32_t exactTimerInt[EXACT_TIMERS] = {
+	INT_TIMER0A, INT_TIMER2A, INT_TIMER3A, INT_TIMER4A, INT_TIMER5A };
+
+#ifdef PROFILE_ISR
+static uint32_t exactTimerDue[EXACT_TIMERS];	// Timebase (low word) when the timer should fire
+
+// How late the timer interrupt is, from the timebase since the core usually
+// sleeps during the wait and the DWT counter stops in WFI
+static inline uint32_t _exactTimerLate(uint8_t ch)
+{
+	int32_t late = (int32_t)((uint32_t)getCycles() - exactTimerDue[ch]);
+	return (late > 0) ? (uint32_t)late : 0;
+}
+#endif
 
+// Delays spin on the DWT cycle counter with the clock rate fixed at
+// compile time, so the clock tree is not decoded on every bit of the
+// bit-banged protocols. Interrupts during the delay are not added to it.
 void delayMicrosec(uint32_t time)
 {
-	// ROM_SysCtlDelay(ROM_SysCtlClockGet()/3000000 * time);
-	SysCtlDelay(SysCtlClockGet()/3000000 * time);
+	delayCycles(time * CLOCKS_IN_US);
 }
 
 void delayMillisec(uint32_t time)
 {
-	// ROM_SysCtlDelay(ROM_SysCtlClockGet()/3000 * time);
-	SysCtlDelay(SysCtlClockGet()/3000 * time);
+	while(time--)
+		delayCycles(1000 * CLOCKS_IN_US);
 }
 
 
-void __attribute__ ((interrupt)) timedFunctionsIntHandler(void)
+// Common part of the exact timer interrupts
+static inline void _timedFunctionsHandler(uint8_t ch)
 {
-	uint8_t i;
-	TimerIntClear(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+	timerCallbackFunction callback = waitCb[ch].callback;
+	PROFILE_ISR_ENTER(_exactTimerLate(ch));
+	PROFILE_START();
+
+	TimerIntClear(exactTimerBase[ch], TIMER_TIMA_TIMEOUT);
+	TRACE_EVENT(TRACE_ISR_TIMED, ch);
+
+	waitMutex[ch] = TIMER_LOCK;	// Timer stopped
+	if(callback)
+		(*callback)(waitCb[ch].data, CALLER_TIMER);	// Handle callback
+
+	PROFILE_TIMED_END(callback);
 
-	waitMutex = TIMER_LOCK;	// Timer stopped
-	if(waitCb.callback)
-		(*waitCb.callback)(timerCb[i].data, CALLER_TIMER);	// Handle callback
+	schedSignal(SCHED_EV_TIMED);		// Wake the thread waiting for the timed function
+	PROFILE_ISR_EXIT(PROFILE_ISR_TIMED);
 }
 
+void __attribute__ ((interrupt)) timedFunctionsIntHandler0(void) { _timedFunctionsHandler(0); }
+void __attribute__ ((interrupt)) timedFunctionsIntHandler1(void) { _timedFunctionsHandler(1); }
+void __attribute__ ((interrupt)) timedFunctionsIntHandler2(void) { _timedFunctionsHandler(2); }
+void __attribute__ ((interrupt)) timedFunctionsIntHandler3(void) { _timedFunctionsHandler(3); }
+void __attribute__ ((interrupt)) timedFunctionsIntHandler4(void) { _timedFunctionsHandler(4); }
+
+static void (* const exactTimerHandler[EXACT_TIMERS])(void) = {
+	timedFunctionsIntHandler0, timedFunctionsIntHandler1, timedFunctionsIntHandler2,
+	timedFunctionsIntHandler3, timedFunctionsIntHandler4 };
+
 void InitTimedFunctions(void)
 {
-	// General timer, meant for one-shot accurate delays
-	if(!SysCtlPeripheralReady(SYSCTL_PERIPH_TIMER0))
-	{
-		SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER0);
-		while(!SysCtlPeripheralReady(SYSCTL_PERIPH_TIMER0));
+	uint8_t i;
+
+	// General timers, meant for one-shot accurate delays
+	for(i=0; i < EXACT_TIMERS; i++) {
+		if(!SysCtlPeripheralReady(exactTimerPeripheral[i]))
+		{
+			SysCtlPeripheralEnable(exactTimerPeripheral[i]);
+			while(!SysCtlPeripheralReady(exactTimerPeripheral[i]));
+		}
+		TimerConfigure(exactTimerBase[i], TIMER_CFG_ONE_SHOT);
+		TimerLoadSet(exactTimerBase[i], TIMER_A, SYSTEM_CLOCK);	// Default
+		TimerIntRegister(exactTimerBase[i], TIMER_A, exactTimerHandler[i]);
+		TimerIntEnable(exactTimerBase[i], TIMER_TIMA_TIMEOUT);
+		IntEnable(exactTimerInt[i]);
+
+		waitMutex[i] = TIMER_FREE;
+		waitCb[i].callback = 0;
 	}
-	TimerConfigure(TIMER0_BASE, TIMER_CFG_ONE_SHOT);
-	TimerLoadSet64(TIMER0_BASE, (uint64_t)SysCtlClockGet());	// Default
-	TimerIntRegister(TIMER0_BASE, TIMER_A, timedFunctionsIntHandler);
-	TimerIntEnable(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
-	// TimerEnable(TIMER0_BASE, TIMER_A);
-	IntEnable(INT_TIMER0A);
 }
 
-// Interrupt for system timer
-// This takes about 528 ns to run (not counting the main loop portion)
-void __attribute__ ((interrupt)) timerIntHandler(void)
+/**
+ * Lock first free exact timer
+ * Called after a unit of RESOURCE_TIMER was taken, so there is always one free.
+ * Interrupts are disabled so that a release from timer interrupt
+ * cannot interleave with the lock
+ */
+uint8_t exactTimerLock(void)
 {
-	// This uses System Tick so the interrupt does not need to be reset
-	if(timerTriggered && timerLatencyError) timerLatencyError--;
-	timerTriggered = 1;
-	//	TimerIntClear(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
-	//	slowTimerTriggered = 1;
+	uint8_t i;
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	for(i=0; i < EXACT_TIMERS; i++) {
+		if(waitMutex[i] == TIMER_FREE) {
+			waitMutex[i] = TIMER_LOCK;
+			break;
+		}
+	}
+	if(!bInt) IntMasterEnable();
+
+	return (i < EXACT_TIMERS) ? i : TIMER_NONE;
 }
 
-void setupTimer(uint32_t timerInterval)
+/**
+ * Start a locked exact timer
+ * Callback is called with data from the timer interrupt after time [us]
+ */
+void exactTimerStart(uint8_t ch, timerCallbackFunction callback, void *data, uint32_t time)
 {
-	// Configure timers for reading sensors
-	// Generic timer for thread scheduling
-	// Using systick
-	SysTickPeriodSet((uint64_t)(SysCtlClockGet() / 1000000) * timerInterval);
-	SysTickIntRegister(timerIntHandler);
-	SysTickEnable();
-
-	// Second timer with multiple callbacks available
-#if 0
-	SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER1);
-	TimerConfigure(TIMER1_BASE, TIMER_CFG_PERIODIC);
-	TimerLoadSet64(TIMER1_BASE, (uint64_t)(SysCtlClockGet() / 1000000) * commonTimerStep);
-	TimerIntRegister(TIMER1_BASE, TIMER_A, commonTimerIntHandler);
-	TimerIntEnable(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
-	TimerEnable(TIMER1_BASE, TIMER_A);
-	IntEnable(INT_TIMER1A);
+	waitCb[ch].callback = callback;
+	waitCb[ch].data = data;
+	waitMutex[ch] = TIMER_RUN;
+	TimerLoadSet(exactTimerBase[ch], TIMER_A, time * CLOCKS_IN_US);
+#ifdef PROFILE_ISR
+	exactTimerDue[ch] = (uint32_t)getCycles() + time * CLOCKS_IN_US;
 #endif
+	TimerEnable(exactTimerBase[ch], TIMER_A);
 }
 
-uint32_t *getFreeTimer(void)
+/**
+ * Release exact timer so that other timed functions can lock it
+ */
+void exactTimerRelease(uint8_t ch)
 {
-	if(nextTimer >= TIMERS) return 0;
-	return &commonTimer[nextTimer++];
-}
+	if(ch >= EXACT_TIMERS) return;
+	waitCb[ch].callback = 0;
+	waitCb[ch].data = 0;
+	waitMutex[ch] = TIMER_FREE;
+	resourceGive(&resources[RESOURCE_TIMER]);		// Wakes the next waiting timed function
+}
 
-void handleTimers(void)
+/**
+ * Abort a timed function in progress
+ * Interrupts are disabled so that the timer cannot continue the function
+ * while it is being reset
+ */
+void timedAbort(timedContext *ctx)
 {
-	uint8_t i;
-	if(timerTriggered)
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	if(ctx->ch < EXACT_TIMERS) {
+		TimerDisable(exactTimerBase[ctx->ch], TIMER_A);
+		TimerIntClear(exactTimerBase[ctx->ch], TIMER_TIMA_TIMEOUT);
+		exactTimerRelease(ctx->ch);
+		ctx->ch = TIMER_NONE;
+		ctx->ticket.state = RESOURCE_TICKET_IDLE;
+	} else {
+		resourceCancel(&resources[RESOURCE_TIMER], &ctx->ticket);
+	}
+	LC_INIT(ctx->pt);
+	ctx->mutex = 0;
+	if(!bInt) IntMasterEnable();
+}
+
+// Callback of the calibration wait, takes the time of the continuation
+static char _timedCalibrateCb(void *pdata, char caller)
+{
+	timedCalibrateCycles = DWT_CYCCNT_R;
+	return RETURN_DONE;
+}
+
+/**
+ * Calibrate the spin limit of TIMER_WAIT
+ * Measures the time from starting a 1 us exact timer wait to the
+ * continuation in the interrupt, minus the wait itself. Returning from the
+ * interrupt and from the timed function costs about the same again, so
+ * waits shorter than twice the measured overhead are cheaper to spin.
+ */
+void timedCalibrate(void)
+{
+	resourceTicket ticket;
+	uint32_t start, overhead;
+	uint8_t ch;
+
+	resourceEnqueue(&resources[RESOURCE_TIMER], &ticket);
+	while(!resourceTryTake(&resources[RESOURCE_TIMER], &ticket));
+	ch = exactTimerLock();
+
+	timedCalibrateCycles = 0;
+	start = DWT_CYCCNT_R;
+	exactTimerStart(ch, (timerCallbackFunction)&_timedCalibrateCb, 0, 1);
+	while(!timedCalibrateCycles);
+	overhead = timedCalibrateCycles - start - CLOCKS_IN_US;
+
+	exactTimerRelease(ch);
+
+	timedSpinCalibrated = (2 * overhead + CLOCKS_IN_US - 1) / CLOCKS_IN_US;	// Rounded up to us
+	timedSpinLimit = timedSpinCalibrated;
+}
+
+/**
+ * Start the watchdog
+ * First timeout only sets the interrupt flag, the second one resets the
+ * system, so the watchdog must be fed at least every WATCHDOG_TIMEOUT.
+ * The counter is stopped while the debugger halts the core.
+ */
+void InitWatchdog(void)
+{
+	if(!SysCtlPeripheralReady(SYSCTL_PERIPH_WDOG0))
 	{
-		timerTriggered = 0;
-		// Decrease timers
-		for(i=0; i<TIMERS; i++)
-			if(commonTimer[i]) commonTimer[i]--;
+		SysCtlPeripheralEnable(SYSCTL_PERIPH_WDOG0);
+		while(!SysCtlPeripheralReady(SYSCTL_PERIPH_WDOG0));
 	}
+	WatchdogReloadSet(WATCHDOG0_BASE, (SYSTEM_CLOCK / 1000) * WATCHDOG_TIMEOUT);
+	WatchdogStallEnable(WATCHDOG0_BASE);
+	WatchdogResetEnable(WATCHDOG0_BASE);
+	WatchdogEnable(WATCHDOG0_BASE);
 }
 
+void watchdogFeed(void)
+{
+	WatchdogIntClear(WATCHDOG0_BASE);
+}
+
+// End of static RAM from the linker script, the stack grows down towards it
+extern uint32_t _ebss;
 
-// Fast timer interrupt
-// Intended to do short time critical sections
-// Handler takes about 560 ... 600 ns / timer + time of any handler @ 80 MHz
-// 580 ns / 1
-// 940 ns / 2
-// 1180 ns / 3
-// 1420 ns / 4
-// 1680 ns / 5
-// 2940 ns / 10
-// When callback is handled, to turn on/off a I/O and re-init the timer, it takes 2110 ns / 4 timers (1 callback)
-void __attribute__ ((interrupt)) commonTimerIntHandler(void)
+// Stack starts from the initial stack pointer, first word of the vector table
+static inline uint32_t *_stackTop(void)
 {
-	uint8_t i;
-	TimerIntClear(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
+	return (uint32_t *)(*(uint32_t *)NVIC_VTABLE_R);
+}
+
+/**
+ * Paint the unused stack for the high-water mark
+ * Stack in use (of the caller) cannot be painted, so this must be called
+ * before the stack gets deep. Everything up to the stack pointer is
+ * overwritten, so nothing that must survive a reset (.noinit) may be
+ * placed between _ebss and the stack.
+ */
+void stackPaint(void)
+{
+	uint32_t *p = &_ebss;
+	uint32_t *sp;
+
+	__asm volatile ("mov %0, sp" : "=r" (sp));
+	sp -= STACK_PAINT_MARGIN / 4;
+	while(p < sp) *p++ = STACK_PAINT;
+}
+
+// Lowest stack word that has ever been written
+static uint32_t *_stackHighWater(void)
+{
+	uint32_t *p = &_ebss;
+	uint32_t *top = _stackTop();
+
+	while(p < top && *p == STACK_PAINT) p++;
+	return p;
+}
+
+uint32_t stackGetUsed(void)
+{
+	return (uint32_t)_stackTop() - (uint32_t)_stackHighWater();
+}
+
+uint32_t stackGetFree(void)
+{
+	return (uint32_t)_stackHighWater() - (uint32_t)&_ebss;
+}
 
-	// Handle callbacks
-	for(i=0; i < TIMER_CALLBACKS; i++)
+uint32_t ramGetStatic(void)
+{
+	return (uint32_t)&_ebss - SRAM_BASE;
+}
+
+void timedSetSpinPolicy(uint8_t policy)
+{
+	if(policy == TIMED_SPIN_ALWAYS) timedSpinLimit = 0xFFFFFFFF;
+	else if(policy == TIMED_SPIN_NEVER) timedSpinLimit = 0;
+	else timedSpinLimit = timedSpinCalibrated;
+}
+
+/**
+ * Enable the DWT cycle counter, used for cycle exact measurements
+ */
+void InitCycleCounter(void)
+{
+	DEMCR_R |= DEMCR_TRCENA;
+	DWT_CYCCNT_R = 0;
+	DWT_CTRL_R |= DWT_CTRL_CYCCNTENA;
+}
+
+/**
+ * Start the 64-bit timebase
+ * WTIMER0 A and B are concatenated to one 64-bit timer that counts CPU
+ * clocks up from zero. Unlike the DWT counter it keeps running while the
+ * core sleeps, and at 80 MHz it does not wrap in practice.
+ */
+void InitTimebase(void)
+{
+	if(!SysCtlPeripheralReady(SYSCTL_PERIPH_WTIMER0))
 	{
-		if(timerCb[i].timer) {
-			timerCb[i].timer--;
-			if(!timerCb[i].timer && timerCb[i].callback) {
-				// Timer reached zero -> triggered
-				(*timerCb[i].callback)(timerCb[i].data, CALLER_TIMER);
-			}
-		}
+		SysCtlPeripheralEnable(SYSCTL_PERIPH_WTIMER0);
+		while(!SysCtlPeripheralReady(SYSCTL_PERIPH_WTIMER0));
 	}
+	TimerConfigure(WTIMER0_BASE, TIMER_CFG_PERIODIC_UP);
+	TimerLoadSet64(WTIMER0_BASE, 0xFFFFFFFFFFFFFFFFULL);
+	TimerEnable(WTIMER0_BASE, TIMER_A);
 }
 
-uint32_t getTimerTime(uint8_t timer)
+// Interrupt for system timer
+// This takes about 528 ns to run (not counting the main loop portion)
+void __attribute__ ((interrupt)) timerIntHandler(void)
 {
-	if(timer >= TIMERS) return 0;
-	return commonTimer[timer];
-}
\ No newline at end of file
+	// SysTick counts down from the reload value, so the counter tells how long ago it wrapped
+	PROFILE_ISR_ENTER(NVIC_ST_RELOAD_R - NVIC_ST_CURRENT_R);
+
+	// This uses System Tick so the interrupt does not need to be reset
+	// Time keeps running even if main loop is late, timers are compared against it
+	sysTime += THREAD_TIMER_INTERVAL / 1000;
+	schedSignal(SCHED_EV_TICK);
+	TRACE_EVENT(TRACE_ISR_TICK, 0);
+
+	PROFILE_ISR_EXIT(PROFILE_ISR_TICK);
+}
+
+void setupTimer(uint32_t timerInterval)
+{
+	// Configure timers for reading sensors
+	// Generic timer for thread scheduling
+	// Using systick
+	SysTickPeriodSet(CLOCKS_IN_US * timerInterval);
+	SysTickIntRegister(timerIntHandler);
+	SysTickEnable();
+}
+
+uint32_t getTime(void)
+{
+	return sysTime;
+}
+
+uint64_t getCycles(void)
+{
+	return TimerValueGet64(WTIMER0_BASE);		// Reads both halves consistently
+}
+
+uint64_t getTimeUs(void)
+{
+	return getCycles() / CLOCKS_IN_US;
+}
+
+threadTimer *getFreeTimer(void)
+{
+	if(nextTimer >= TIMERS) return 0;
+	return &commonTimer[nextTimer++];
+}
+
+void timerStart(threadTimer *timer, uint32_t time)
+{
+	timerStartAt(timer, sysTime + time);
+}
+
+// Start timer to expire at absolute deadline
+// Timer is inserted to the pending list in deadline order
+void timerStartAt(threadTimer *timer, uint32_t deadline)
+{
+	threadTimer **pos;
+
+	timerStop(timer);
+
+	timer->deadline = deadline;
+	timer->running = 1;
+
+	pos = &pendingTimers;
+	while(*pos && TIME_AFTER_EQ(timer->deadline, (*pos)->deadline))
+		pos = &(*pos)->next;
+	timer->next = *pos;
+	*pos = timer;
+}
+
+void timerStop(threadTimer *timer)
+{
+	threadTimer **pos;
+
+	if(!timer->running) return;
+
+	for(pos = &pendingTimers; *pos; pos = &(*pos)->next) {
+		if(*pos == timer) {
+			*pos = timer->next;
+			break;
+		}
+	}
+	timer->running = 0;
+	timer->next = 0;
+}
+
+uint8_t timerExpired(threadTimer *timer)
+{
+	return timer->running ? 0 : 1;
+}
+
+uint32_t timerRemaining(threadTimer *timer)
+{
+	uint32_t now = sysTime;
+	if(!timer->running || TIME_AFTER_EQ(now, timer->deadline)) return 0;
+	return timer->deadline - now;
+}
+
+// Expire timers from the head of the pending list
+// Only the earliest deadline needs to be checked, so cost per tick is constant
+void handleTimers(void)
+{
+	uint32_t now = sysTime;
+	threadTimer *timer;
+
+	while(pendingTimers && TIME_AFTER_EQ(now, pendingTimers->deadline)) {
+		timer = pendingTimers;
+		pendingTimers = timer->next;
+		timer->running = 0;
+		timer->next = 0;
+	}
+}
+
+periodicTimer *getFreePeriodic(uint32_t period)
+{
+	periodicTimer *p;
+
+	if(nextPeriodic >= PERIODIC_TIMERS) return 0;
+	p = &periodicTimers[nextPeriodic++];
+	p->period = period;
+	p->release = sysTime;
+	return p;
+}
+
+periodicTimer *getPeriodic(uint8_t n)
+{
+	if(n >= nextPeriodic) return 0;
+	return &periodicTimers[n];
+}
+
+// Next release is computed from the previous release, not from now
+// If the thread was late by one or more whole periods, those releases are
+// counted as overruns and skipped, keeping the original phase
+void periodicNext(periodicTimer *p)
+{
+	uint32_t now = sysTime;
+	uint32_t missed;
+
+	p->release += p->period;
+	if(TIME_AFTER_EQ(now, p->release + p->period)) {
+		missed = (now - p->release) / p->period;
+		p->release += missed * p->period;
+		p->overruns += missed;
+	}
+	timerStartAt(&p->timer, p->release);
+}
+
+void periodicReleased(periodicTimer *p)
+{
+	uint32_t jitter = sysTime - p->release;
+
+	p->releases++;
+	p->jitterTotal += jitter;
+	if(jitter > p->jitterMax) p->jitterMax = jitter;
+}
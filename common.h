@@ -3,13 +3,38 @@
 
 // Common #defines that should be available everywhere
 #define CLOCKS_IN_US		80			// 80 MHz -> 80 clocks in one microsecond
-
-
-#define TIMERS				7
-#define TIMER_CALLBACKS		5
+#define SYSTEM_CLOCK		(CLOCKS_IN_US * 1000000)	// System clock [Hz], same as SysCtlClockGet()
+
+// Build options
+//#define PROFILE						// Collect per-thread run time statistics (see profile.h)
+//#define PROFILE_ISR					// Collect interrupt latency and duration histograms (see profile.h)
+//#define SCHED_EDF						// Run the most urgent thread first instead of table order (see sched.h)
+//#define TRACE							// Record events to a RAM ring buffer (see trace.h)
+
+// Cortex-M4 DWT cycle counter
+#define DEMCR_R				(*((volatile uint32_t *)0xE000EDFC))	// Debug exception and monitor control
+#define DWT_CTRL_R			(*((volatile uint32_t *)0xE0001000))
+#define DWT_CYCCNT_R		(*((volatile uint32_t *)0xE0001004))	// Counts CPU clocks, wraps in ~53 s
+#define DEMCR_TRCENA		0x01000000
+#define DWT_CTRL_CYCCNTENA	0x00000001
+
+// Busy wait given number of CPU clocks, accurate to a few clocks
+// Counter must be started with InitCycleCounter()
+static inline void delayCycles(uint32_t cycles)
+{
+	uint32_t start = DWT_CYCCNT_R;
+	while((uint32_t)(DWT_CYCCNT_R - start) < cycles);
+}
+
+
+#define TIMERS				7			// Thread timers available from getFreeTimer()
+#define PERIODIC_TIMERS		4			// Periodic timers available from getFreePeriodic()
+#define EXACT_TIMERS		5			// Hardware timers for timed functions (TIMER0, TIMER2...TIMER5)
 
 #define THREAD_TIMER_INTERVAL			1000		// Timer running period [us] (system timer, i.e. thread timer)
-#define commonTimerStep		1000		// Common callback timer running period [us]
+#define WATCHDOG_TIMEOUT	2000		// [ms] Reset after two timeouts without feeding
+#define STACK_PAINT			0x5354434B	// "STCK", fill of stack that has never been used
+#define STACK_PAINT_MARGIN	64			// [bytes] Left unpainted below the stack pointer of the caller
 
 
 // Common defines used everywhere
@@ -33,6 +58,43 @@
 //#define TO_FAST_TIMER_VALUE(x) (x / fastTimerStep)
 //#define TO_COMMON_TIMER_VALUE(x) (x / timerStep)
 
+// Wrap-safe comparison of system times, true if time a is at or after time b
+#define TIME_AFTER_EQ(a, b)	((int32_t)((uint32_t)(a) - (uint32_t)(b)) >= 0)
+
+// Thread timer, expires at an absolute deadline of the system time
+// Running timers are kept in a list sorted by deadline
+typedef struct _threadTimer {
+	uint32_t deadline;					// System time [ms] when the timer expires
+	uint8_t running;					// 1 while waiting for the deadline
+	struct _threadTimer *next;			// Next running timer with later deadline
+} threadTimer;
+
+// Periodic thread timer
+// Releases are phase-locked, i.e. the next release is the previous release
+// plus the period, so the time the thread spends working does not stretch it.
+// Every release keeps track of how late the thread was started.
+typedef struct _periodicTimer {
+	threadTimer timer;
+	uint32_t period;					// [ms]
+	uint32_t release;					// System time [ms] of latest release
+	uint32_t releases;					// Number of releases
+	uint32_t overruns;					// Releases skipped since thread was late by a whole period
+	uint32_t jitterMax;					// Longest delay from release to start of the thread [ms]
+	uint32_t jitterTotal;				// Sum of the delays [ms]
+} periodicTimer;
+
+// Place of a waiter in the queue of a shared resource (resource.h)
+// Must be kept over yields, i.e. static or part of the driver state
+typedef struct _resourceTicket {
+	struct _resourceTicket *next;		// Next waiter in the queue
+	uint32_t since;						// Time [us] when queued
+	uint8_t state;						// RESOURCE_TICKET_*
+} resourceTicket;
+
+#define RESOURCE_TICKET_IDLE	0			// Not queued and not holding
+#define RESOURCE_TICKET_QUEUED	1
+#define RESOURCE_TICKET_HELD	2
+
 // Timer callback function prototype
 typedef void (*timerCallbackFunction)(void *pdata, char caller);
 
@@ -44,13 +106,15 @@ typedef struct _timerCallback {
 } timerCallback;
 
 
-extern volatile uint8_t waitMutex;		// Lock for the exact wait timer
-extern volatile timerCallback waitCb;	// Callback for exact waitCb
+extern volatile uint8_t waitMutex[EXACT_TIMERS];		// Locks for the exact wait timers
+extern volatile timerCallback waitCb[EXACT_TIMERS];	// Callbacks for exact wait timers
 
 #define TIMER_FREE			0
 #define TIMER_LOCK			1
 #define TIMER_RUN			2
 
+#define TIMER_NONE			0xFF		// No exact timer locked
+
 // Common helper functions
 
 #define CALLER_TIMER		1
@@ -59,81 +123,220 @@ extern volatile timerCallback waitCb;	// Callback for exact waitCb
 #define RETURN_WAIT			0
 #define RETURN_DONE			1
 
+// State of a timed function in progress
+// Kept in the device (instance) struct instead of function statics, so the
+// same timed function can run for several devices at the same time. One
+// context can be shared by all timed functions of a device, as long as only
+// one of them is in progress at a time.
+typedef struct _timedContext {
+	lc_t pt;							// Local continuation, 0 = not started
+	char mutex;							// 1 while waiting for the exact timer
+	uint8_t ch;							// Locked exact timer, TIMER_NONE if none
+	resourceTicket ticket;				// Place in the exact timer queue
+#ifdef PROFILE
+	uint32_t waitStart;					// Timebase (low word) when TIMER_WAIT was started
+#endif
+} timedContext;
+
+// Static initializer of a timed function context
+#define TIMED_CONTEXT_INIT		{ 0, 0, TIMER_NONE, { 0, 0 } }
+
+// Timed function, pdata is the device given by the calling thread and
+// is passed back to the function when it is continued from the timer
 #define TIMED_FUNCTION(name_args) char name_args(void *pdata, char caller)
 
-#define TIMED_BEGIN()											\
-	static unsigned short _timed_pt = 0;						\
-	static char _timed_mutex = 0;								\
-	if(_timed_mutex && caller == CALLER_THREAD) return RETURN_WAIT;		\
-	switch(_timed_pt) {											\
-	case 0:
+// Start of the timed function, ctx is the timedContext of the device
+// Continuations use the same local continuation backend as protothreads (lc.h)
+#define TIMED_BEGIN(ctx)										\
+	timedContext *_timed = (ctx);								\
+	char _timed_resumed = 1;									\
+	if(_timed->mutex && caller == CALLER_THREAD) return RETURN_WAIT;	\
+	LC_RESUME(_timed->pt)
 
 #define TIMED_END()												\
-	}															\
-	_timed_pt = 0;												\
-	_timed_mutex = 0;											\
+	LC_END(_timed->pt);											\
+	LC_INIT(_timed->pt);										\
+	_timed->mutex = 0;											\
 	return RETURN_DONE;
 
-// Wait (and block) until exact timer is available
+// Wait (and block) until one of the exact timers is available
+// Waiting functions get the timers in the order they started waiting.
+// The locked timer is used by this invocation until RELEASE_TIMER
 #define LOCK_TIMER()											\
 	do {														\
-		_timed_pt = __LINE__; case __LINE__:					\
-		if(waitMutex != TIMER_FREE) return RETURN_WAIT;			\
-		waitMutex = TIMER_LOCK;									\
+		resourceEnqueue(&resources[RESOURCE_TIMER], &_timed->ticket);	\
+		LC_SET(_timed->pt);										\
+		if(!resourceTryTake(&resources[RESOURCE_TIMER], &_timed->ticket)) return RETURN_WAIT;	\
+		_timed->ch = exactTimerLock();							\
 	} while(0)
 
+// Policies of TIMER_WAIT, see timedSetSpinPolicy()
+#define TIMED_SPIN_AUTO		0			// Spin below the calibrated limit, timer otherwise
+#define TIMED_SPIN_ALWAYS	1
+#define TIMED_SPIN_NEVER	2
+
+// Waits shorter than this [us] are spun instead of using the exact timer
+extern uint32_t timedSpinLimit;
+
+// Measure accuracy of the waits (see profile.h)
+// Timer waits usually sleep, so they are timed with the timebase, not the DWT counter
+#ifdef PROFILE
+#define TIMED_WAIT_START()			_timed->waitStart = (uint32_t)getCycles()
+#define TIMED_WAIT_END(spin, time)	profileWait((spin), (time) * CLOCKS_IN_US, (uint32_t)getCycles() - _timed->waitStart)
+#else
+#define TIMED_WAIT_START()
+#define TIMED_WAIT_END(spin, time)
+#endif
+
 // Schedule continuation with exact timer
+// Files using this must include trace.h
 // Note that this is called from interrupt, so if any other thread uses
 // same resources as this while this timer is running, they need to be
 // volatile or otherwise thread safe!
 // Time is given in us
+// Waits shorter than timedSpinLimit busy wait on the cycle counter instead,
+// since the interrupt entry, exit and resume would cost more than the wait.
+// Continuation is set before the timer is started, since the interrupt may
+// continue the function before exactTimerStart returns
 #define TIMER_WAIT(func, time)									\
 	do {														\
-		waitCb.callback = &func;								\
-				waitMutex = TIMER_RUN;							\
-				_timed_mutex = 1;								\
-		TimerLoadSet64(TIMER0_BASE, time * CLOCKS_IN_US);		\
-		TimerEnable(TIMER0_BASE, TIMER_A);						\
-				_timed_pt = __LINE__; case __LINE__:			\
-		if(waitMutex == TIMER_RUN) return RETURN_WAIT;			\
-				_timed_mutex = 0;								\
+		TIMED_WAIT_START();										\
+		if((uint32_t)(time) < timedSpinLimit) {					\
+			TRACE_EVENT(TRACE_TIMED_SPIN, time);				\
+			delayCycles((time) * CLOCKS_IN_US);					\
+			TIMED_WAIT_END(1, time);							\
+			break;												\
+		}														\
+		_timed_resumed = 0;										\
+		_timed->mutex = 1;										\
+		LC_SET(_timed->pt);										\
+		if(!_timed_resumed) {									\
+			TRACE_EVENT(TRACE_TIMED_WAIT, time);				\
+			exactTimerStart(_timed->ch, (timerCallbackFunction)&func, pdata, time);	\
+			return RETURN_WAIT;									\
+		}														\
+		if(waitMutex[_timed->ch] == TIMER_RUN) return RETURN_WAIT;	\
+		_timed->mutex = 0;										\
+		TIMED_WAIT_END(0, time);								\
 	} while(0)
 
 // Yield from exact timer (interrupt callback) and continue next time the thread is run
 // (without releasing the timer mutex)
 #define TIMER_YIELD()											\
 	do {														\
-		_timed_pt = __LINE__; case __LINE__:					\
+		LC_SET(_timed->pt);										\
 		if(caller == CALLER_TIMER) return RETURN_WAIT;			\
 	} while(0)
 
 // Release the exact timer
 #define RELEASE_TIMER()											\
 	do {														\
-		waitCb.callback = 0;									\
-		waitMutex = TIMER_FREE;									\
-		_timed_pt = __LINE__; case __LINE__:					\
+		exactTimerRelease(_timed->ch);							\
+		_timed->ch = TIMER_NONE;								\
+		_timed->ticket.state = RESOURCE_TICKET_IDLE;			\
+		LC_SET(_timed->pt);										\
 		if(caller == CALLER_TIMER) return RETURN_WAIT;			\
 	} while(0)
 
 
-// Microsecond delay
+// Microsecond delay, busy waits on the cycle counter
 void delayMicrosec(uint32_t time);
 
 // Millisecond delay
 void delayMillisec(uint32_t time);
 
-// Initialize the timer used for exact wait macros
+// Initialize the timers used for exact wait macros
 void InitTimedFunctions(void);
 
+// Start the DWT cycle counter
+void InitCycleCounter(void);
+
+// Start the free running 64-bit timebase (WTIMER0)
+void InitTimebase(void);
+
+// Start the watchdog, resets the system unless fed in time
+void InitWatchdog(void);
+
+// Feed the watchdog
+void watchdogFeed(void);
+
+// Fill the stack between static RAM (_ebss) and the stack pointer with
+// STACK_PAINT, called first thing in main() while the stack is shallow
+void stackPaint(void);
+
+// Deepest stack use since stackPaint() [bytes]
+uint32_t stackGetUsed(void);
+
+// Stack that has never been used, i.e. headroom for more static RAM [bytes]
+uint32_t stackGetFree(void);
+
+// Static RAM, data and bss of everything linked [bytes]
+uint32_t ramGetStatic(void);
+
+// Lock a free exact timer, returns timer number or TIMER_NONE if all are in use
+uint8_t exactTimerLock(void);
+
+// Start locked exact timer, callback is called from interrupt after time [us]
+void exactTimerStart(uint8_t ch, timerCallbackFunction callback, void *data, uint32_t time);
+
+// Release locked exact timer
+void exactTimerRelease(uint8_t ch);
+
+// Abort the timed function of ctx, e.g. when its thread is restarted
+// Stops and releases its exact timer, or leaves the queue for one
+void timedAbort(timedContext *ctx);
+
+// Measure the cost of an exact timer wait and set the spin limit
+// Needs interrupts enabled and a free exact timer
+void timedCalibrate(void);
+
+// Select TIMER_WAIT policy (TIMED_SPIN_*)
+void timedSetSpinPolicy(uint8_t policy);
+
 void setupTimer(uint32_t timerInterval);
 
+// Get monotonic system time in milliseconds (wraps after ~49 days)
+uint32_t getTime(void);
+
+// Get CPU clocks since InitTimebase(), never wraps
+uint64_t getCycles(void);
+
+// Get monotonic time in microseconds since InitTimebase(), never wraps
+// Lower 32 bits can be used as a timestamp for intervals below ~71 minutes
+uint64_t getTimeUs(void);
+
 // Get pointer to a free timer instead of global variables
-uint32_t *getFreeTimer(void);
+threadTimer *getFreeTimer(void);
 
+// Start the timer to expire after given time [ms] from now
+void timerStart(threadTimer *timer, uint32_t time);
+
+// Start the timer to expire at given system time [ms]
+void timerStartAt(threadTimer *timer, uint32_t deadline);
+
+// Stop the timer, i.e. make it expired
+void timerStop(threadTimer *timer);
+
+// Returns 1 if timer has expired (or was never started)
+uint8_t timerExpired(threadTimer *timer);
+
+// Get remaining time [ms] before timer expires, 0 if expired
+uint32_t timerRemaining(threadTimer *timer);
+
+// Expire the timers whose deadline has passed
 void handleTimers(void);
 
-// Get remaining time in timer, 0 on error
-uint32_t getTimerTime(uint8_t timer);
+// Get a periodic timer, first release is one period from now
+// Returns 0 if all are in use
+periodicTimer *getFreePeriodic(uint32_t period);
+
+// Get periodic timer n for statistics, 0 if not in use
+periodicTimer *getPeriodic(uint8_t n);
+
+// Advance to next release and start the timer, skipping releases that were missed
+void periodicNext(periodicTimer *p);
+
+// Thread was released, update jitter statistics
+void periodicReleased(periodicTimer *p);
 
 #endif
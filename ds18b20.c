@@ -8,7 +8,8 @@
  *
  * Currently this driver supports only externally powered devices, and 
  * only one sensor on the bus, i.e. no search is done and skip rom
- * command is used a lot.
+ * command is used a lot. Several buses can be used, each with a dsBus
+ * struct and a thread of its own.
  *
  * Copyright (C) 2016 Lauri Peltonen
  */
@@ -18,6 +19,7 @@ typedef uint8_t bool;
 #include "inc/tm4c123gh6pm.h"
 #include "inc/hw_types.h"
 #include "inc/hw_memmap.h"
+#include "inc/hw_gpio.h"
 
 #include "driverlib/sysctl.h"
 #include "driverlib/gpio.h"
@@ -26,23 +28,17 @@ typedef uint8_t bool;
 
 #include "pt.h"
 
-#include "ds18b20.h"
 #include "common.h"
+#include "sched.h"
+#include "resource.h"
+#include "profile.h"
+#include "trace.h"
+#include "pin.h"
+#include "ds18b20.h"
 
 
-// Port & pin mappings
-const uint32_t dsPeripheral = SYSCTL_PERIPH_GPIOB;
-const uint32_t dsPort = GPIO_PORTB_BASE;
-const uint32_t dsPin = GPIO_PIN_2;					// PB2
-
-// Variables
-//uint8_t dsTimedFound = 0;							// Device found in bus, used in timed function
-//volatile uint8_t dsConvDoneTimed = 0;				// Conversion done flag, used in timed function
-static uint8_t dsFlags = 0;
-static dsScratchpad dsData;
-
-// Timer
-uint32_t *dsTimer;
+// Port & pin mappings of the default bus, PB2
+dsBus dsDefault = DS_BUS_INIT(SYSCTL_PERIPH_GPIOB, GPIO_PORTB_BASE, GPIO_PIN_2);
 
 
 /**
@@ -50,26 +46,45 @@ uint32_t *dsTimer;
  *
  * I.e. pins and ports, all communications are done on software
  */
-void dsSetup(void)
+void dsBusSetup(dsBus *bus)
 {
 	bool bInt;
 
 	// Enable output GPIO peripheral if not yet enabled
-	if(!SysCtlPeripheralReady(dsPeripheral))
+	if(!SysCtlPeripheralReady(bus->peripheral))
 	{
-		SysCtlPeripheralEnable(dsPeripheral);
-		while(!SysCtlPeripheralReady(dsPeripheral));
+		SysCtlPeripheralEnable(bus->peripheral);
+		while(!SysCtlPeripheralReady(bus->peripheral));
 	}
 
 	// Initialize pin types and set values
 	bInt = IntMasterDisable();
-	GPIOPinTypeGPIOOutputOD(dsPort, dsPin);
-	GPIOPinWrite(dsPort, dsPin, dsPin);				// Pin = 1 => ext pull-up
+	GPIOPinTypeGPIOOutputOD(bus->port, bus->pin);
+	pinWrite(bus->port, bus->pin, bus->pin);		// Pin = 1 => ext pull-up
 	if(bInt) IntMasterEnable();
 
-	dsTimer = getFreeTimer();
-	if(dsTimer)
-		*dsTimer = DS_TIME_INTERVAL;
+	bus->period = getFreePeriodic(DS_TIME_INTERVAL);
+}
+
+void dsSetup(void)
+{
+	dsBusSetup(&dsDefault);
+}
+
+/**
+ * Thread was restarted by the supervisor
+ * Aborts the timed function in progress and releases the bus
+ */
+void dsBusRecover(dsBus *bus)
+{
+	timedAbort(&bus->timed);
+	pinWrite(bus->port, bus->pin, bus->pin);		// Let float high
+	bus->flags &= ~DS_DATA_VALID;
+}
+
+void dsRecover(void)
+{
+	dsBusRecover(&dsDefault);
 }
 
 /**
@@ -78,19 +93,19 @@ void dsSetup(void)
  * Data can be zero for 0 or nonzero for 1
  * This function blocks until write is done.
  */
-inline void _dsWriteBit(uint8_t data)
+inline void _dsWriteBit(dsBus *bus, uint8_t data)
 {
 	//bool bInt;
 
 	//bInt = IntMasterDisable();
-	GPIOPinWrite(dsPort, dsPin, 0);					// Data low
+	pinWrite(bus->port, bus->pin, 0);				// Data low
 	if(data) {
 		delayMicrosec(DS_WRITE_1);
-		GPIOPinWrite(dsPort, dsPin, dsPin);			// Back up
+		pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 		delayMicrosec(DS_WRITE_1_WAIT);
 	} else {
 		delayMicrosec(DS_WRITE_0);
-		GPIOPinWrite(dsPort, dsPin, dsPin);			// Back up
+		pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 		delayMicrosec(DS_WRITE_0_WAIT);
 	}
 	//if(bInt) IntMasterEnable();
@@ -102,22 +117,22 @@ inline void _dsWriteBit(uint8_t data)
  * Return 0xFF (all bits on) for 1 or 0x00 for 0
  * This function blocks until read is done.
  */
-inline uint8_t _dsReadBit()
+inline uint8_t _dsReadBit(dsBus *bus)
 {
 	//bool bInt;
 	uint8_t data;
 
 	//bInt = IntMasterDisable();
 
-	GPIOPinWrite(dsPort, dsPin, 0);					// Data low
+	pinWrite(bus->port, bus->pin, 0);				// Data low
 	delayMicrosec(DS_READ_PULSE);
 
-	GPIOPinWrite(dsPort, dsPin, dsPin);				// Back up
-	GPIOPinTypeGPIOInput(dsPort, dsPin);			// Change to input and after wait read status
+	pinWrite(bus->port, bus->pin, bus->pin);		// Back up
+	GPIOPinTypeGPIOInput(bus->port, bus->pin);		// Change to input and after wait read status
 	delayMicrosec(DS_READ_DELAY);
 
-	data = GPIOPinRead(dsPort, dsPin);
-	GPIOPinTypeGPIOOutputOD(dsPort, dsPin);			// Re-configure as output for next cycle
+	data = pinRead(bus->port, bus->pin);
+	GPIOPinTypeGPIOOutputOD(bus->port, bus->pin);	// Re-configure as output for next cycle
 	delayMicrosec(DS_READ_WAIT);
 
 	//if(bInt) IntMasterEnable();
@@ -128,13 +143,13 @@ inline uint8_t _dsReadBit()
 /**
  * Write byte (8 bits) to bus, blocking
  */
-void _dsWriteByte(uint8_t data)
+void _dsWriteByte(dsBus *bus, uint8_t data)
 {
 	uint8_t i = 0b00000001;							// LSB first
 
 	// Loop until i overflows after MSB
 	while(i) {
-		_dsWriteBit(data & i);
+		_dsWriteBit(bus, data & i);
 		i <<= 1;
 	}
 }
@@ -142,14 +157,14 @@ void _dsWriteByte(uint8_t data)
 /**
  * Read a byte (8 bits) from the bus, blocking
  */
-uint8_t _dsReadByte(void)
+uint8_t _dsReadByte(dsBus *bus)
 {
 	uint8_t i = 0b00000001;							// Read LSB first
 	uint8_t data = 0;
 
 	// Loop until overflow after MSB
 	while(i) {
-		data |= _dsReadBit() & i;
+		data |= _dsReadBit(bus) & i;
 		i <<= 1;
 	}
 
@@ -159,24 +174,24 @@ uint8_t _dsReadByte(void)
 /**
  * Send a reset command to bus, blocking
  */
-uint8_t dsReset(void)
+uint8_t dsReset(dsBus *bus)
 {
 	//bool bInt;
 	uint8_t found = 0;
 
 	//bInt = IntMasterDisable();
 
-	GPIOPinWrite(dsPort, dsPin, 0);					// Pull data low
+	pinWrite(bus->port, bus->pin, 0);				// Pull data low
 	delayMicrosec(DS_RESET_PULSE);
 
-	GPIOPinWrite(dsPort, dsPin, dsPin);				// Let float high
-	GPIOPinTypeGPIOInput(dsPort, dsPin);			// Change to input and after wait read status
+	pinWrite(bus->port, bus->pin, bus->pin);		// Let float high
+	GPIOPinTypeGPIOInput(bus->port, bus->pin);		// Change to input and after wait read status
 	delayMicrosec(DS_RESET_DELAY);
-	found = GPIOPinRead(dsPort, dsPin);
+	found = pinRead(bus->port, bus->pin);
 
 	delayMicrosec(DS_RESET_WAIT);
 
-	GPIOPinTypeGPIOOutputOD(dsPort, dsPin);
+	GPIOPinTypeGPIOOutputOD(bus->port, bus->pin);
 	//delayMicrosec(DS_RESET_DELAY2);
 
 	//if(bInt) IntMasterEnable();
@@ -187,7 +202,7 @@ uint8_t dsReset(void)
 /**
  * Rom search command, not implemented
  */
-uint8_t dsSearchRom(void)
+uint8_t dsSearchRom(dsBus *bus)
 {
 	return 0;
 }
@@ -195,18 +210,18 @@ uint8_t dsSearchRom(void)
 /**
  * Read ROM code from device on the bus, blocking
  */
-uint8_t dsReadRom(dsROMCode *pROMCode)
+uint8_t dsReadRom(dsBus *bus, dsROMCode *pROMCode)
 {
 	uint8_t i;
 
 	if(!pROMCode) return 0;
-	if(!dsReset()) return 0;						// No device on the bus
-	dsSkipRom();
-	_dsWriteByte(0x33);
+	if(!dsReset(bus)) return 0;						// No device on the bus
+	dsSkipRom(bus);
+	_dsWriteByte(bus, 0x33);
 
 	// Read 8 bytes
 	for(i=0;i<8;i++)
-		pROMCode->raw[i] = _dsReadByte();
+		pROMCode->raw[i] = _dsReadByte(bus);
 
 	return 1;
 }
@@ -214,15 +229,15 @@ uint8_t dsReadRom(dsROMCode *pROMCode)
 /**
  * Send a Match ROM command, blocking
  */
-uint8_t dsMatchRom(dsROMCode *pROMCode)
+uint8_t dsMatchRom(dsBus *bus, dsROMCode *pROMCode)
 {
 	uint8_t i;
 
 	if(!pROMCode) return 0;
 
-	_dsWriteByte(0x55);
+	_dsWriteByte(bus, 0x55);
 	for(i=0;i<8;i++)								// TODO: High byte or low byte first?!
-		_dsWriteByte(pROMCode->raw[i]);
+		_dsWriteByte(bus, pROMCode->raw[i]);
 
 	return 1;
 }
@@ -230,15 +245,15 @@ uint8_t dsMatchRom(dsROMCode *pROMCode)
 /**
  * Send Skip ROM command, blocking
  */
-void dsSkipRom(void)
+void dsSkipRom(dsBus *bus)
 {
-	_dsWriteByte(0xCC);
+	_dsWriteByte(bus, 0xCC);
 }
 
 /**
  * Do an alarm search, not implemented
  */
-uint8_t dsAlarmSearch(dsROMCode *pROMCode)
+uint8_t dsAlarmSearch(dsBus *bus, dsROMCode *pROMCode)
 {
 	return 0;
 }
@@ -246,11 +261,11 @@ uint8_t dsAlarmSearch(dsROMCode *pROMCode)
 /**
  * Start temperature conversion, blocking
  */
-uint8_t dsConvertT(uint8_t power)
+uint8_t dsConvertT(dsBus *bus, uint8_t power)
 {
-	if(!dsReset()) return;								// No device on the bus
-	dsSkipRom();
-	_dsWriteByte(0x44);
+	if(!dsReset(bus)) return;								// No device on the bus
+	dsSkipRom(bus);
+	_dsWriteByte(bus, 0x44);
 
 	return 1;
 }
@@ -259,94 +274,95 @@ uint8_t dsConvertT(uint8_t power)
  * Check whether temperature conversion is done
  * Only works with externally powered chips
  */
-uint8_t dsConversionDone(void)
+uint8_t dsConversionDone(dsBus *bus)
 {
-	return _dsReadBit();
+	return _dsReadBit(bus);
 }
 
 /**
  * Write temperature limits and config to device
  * Skips ROM, blocking
  */
-void dsWrite(uint8_t Th, uint8_t Tl, uint8_t conf)
+void dsWrite(dsBus *bus, uint8_t Th, uint8_t Tl, uint8_t conf)
 {
-	if(!dsReset()) return;								// No device on the bus
-	dsSkipRom();
-	_dsWriteByte(0x4E);
-	_dsWriteByte(Th);
-	_dsWriteByte(Tl);
-	_dsWriteByte(conf);
+	if(!dsReset(bus)) return;								// No device on the bus
+	dsSkipRom(bus);
+	_dsWriteByte(bus, 0x4E);
+	_dsWriteByte(bus, Th);
+	_dsWriteByte(bus, Tl);
+	_dsWriteByte(bus, conf);
 }
 
 /**
  * Read the scrathpad memory from the chip
  * Skips ROM, blocking
  */
-uint8_t dsRead(dsScratchpad *pData)
+uint8_t dsRead(dsBus *bus, dsScratchpad *pData)
 {
 	uint8_t i;
 
 	if(!pData) return 0;								// NULL pointer exception
-	if(!dsReset()) return 0;							// No device on the bus
-	dsSkipRom();
-	_dsWriteByte(0xBE);
+	if(!dsReset(bus)) return 0;							// No device on the bus
+	dsSkipRom(bus);
+	_dsWriteByte(bus, 0xBE);
 
 	// Read 9 bytes
 	for(i=0;i<9;i++) {
-		pData->raw[i] = _dsReadByte();
+		pData->raw[i] = _dsReadByte(bus);
 	}
 	return 1;
 }
 
-void dsCopy(uint8_t power)
+void dsCopy(dsBus *bus, uint8_t power)
 {
-	if(!dsReset()) return;							// No device on the bus
-	dsSkipRom();
-	_dsWriteByte(0x48);
+	if(!dsReset(bus)) return;							// No device on the bus
+	dsSkipRom(bus);
+	_dsWriteByte(bus, 0x48);
 }
 
-void dsRecall(void)
+void dsRecall(dsBus *bus)
 {
-	if(!dsReset()) return;							// No device on the bus
-	dsSkipRom();
-	_dsWriteByte(0x48);
+	if(!dsReset(bus)) return;							// No device on the bus
+	dsSkipRom(bus);
+	_dsWriteByte(bus, 0x48);
 }
 
-uint8_t dsReadPower(void)
+uint8_t dsReadPower(dsBus *bus)
 {
-	if(!dsReset()) return 0;						// No device on the bus
-	dsSkipRom();
-	_dsWriteByte(0xB4);
+	if(!dsReset(bus)) return 0;						// No device on the bus
+	dsSkipRom(bus);
+	_dsWriteByte(bus, 0xB4);
 
-	return _dsReadBit() ? 1 : 2;
+	return _dsReadBit(bus) ? 1 : 2;
 }
 
 /**
  * Reset the one-wire bus
- * This is a non-blocking (timed) function
+ * This is a non-blocking (timed) function, pdata is the bus
  */
 TIMED_FUNCTION(dsResetTimed)
 {
-	TIMED_BEGIN();
+	dsBus *bus = (dsBus *)pdata;
+	TIMED_BEGIN(&bus->timed);
 
 	// Wait until timer is free, then lock it
 	LOCK_TIMER();
 
-	dsFlags &= ~DS_DEVICE_FOUND;
+	bus->flags &= ~DS_DEVICE_FOUND;
 
-	GPIOPinWrite(dsPort, dsPin, 0);							// Pull data low
+	pinWrite(bus->port, bus->pin, 0);						// Pull data low
 	TIMER_WAIT(dsResetTimed, DS_RESET_PULSE);				// Wait here
 
-	GPIOPinWrite(dsPort, dsPin, dsPin);						// Let float high
-	GPIOPinTypeGPIOInput(dsPort, dsPin);					// Change to input and after wait read status
+	pinWrite(bus->port, bus->pin, bus->pin);				// Let float high
+	GPIOPinTypeGPIOInput(bus->port, bus->pin);				// Change to input and after wait read status
 	TIMER_WAIT(dsResetTimed, DS_RESET_DELAY);
 
-	if(!GPIOPinRead(dsPort, dsPin))							// Slave pulls down if present, thus inverted!
-		dsFlags |= DS_DEVICE_FOUND;
+	if(!pinRead(bus->port, bus->pin))						// Slave pulls down if present, thus inverted!
+		bus->flags |= DS_DEVICE_FOUND;
 
 	TIMER_WAIT(dsResetTimed, DS_RESET_WAIT);
 
-	GPIOPinTypeGPIOOutputOD(dsPort, dsPin);
+	GPIOPinTypeGPIOOutputOD(bus->port, bus->pin);
 	//TIMER_WAIT(dsResetTimed, DS_RESET_DELAY2);
 
 	RELEASE_TIMER();
@@ -361,48 +377,46 @@ TIMED_FUNCTION(dsResetTimed)
  */
 TIMED_FUNCTION(dsConvertTTimed)
 {
-	static uint8_t i = 1;
-	static uint8_t data = 0x00;
-
-	TIMED_BEGIN();
+	dsBus *bus = (dsBus *)pdata;
+	TIMED_BEGIN(&bus->timed);
 
 	LOCK_TIMER();
 
 	// Skip ROM: Write 0xCC (Only 1 device allowed on the bus!)
-	i = 0b00000001;											// LSB first
-	data = 0xCC;
-	while(i) {
-		GPIOPinWrite(dsPort, dsPin, 0);						// Data low
-		if(data & i) {
+	bus->bit = 0b00000001;									// LSB first
+	bus->data = 0xCC;
+	while(bus->bit) {
+		pinWrite(bus->port, bus->pin, 0);					// Data low
+		if(bus->data & bus->bit) {
 			TIMER_WAIT(dsConvertTTimed, DS_WRITE_1);
-			GPIOPinWrite(dsPort, dsPin, dsPin);				// Back up
+			pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 			TIMER_WAIT(dsConvertTTimed, DS_WRITE_1_WAIT);
 		} else {
 			TIMER_WAIT(dsConvertTTimed, DS_WRITE_0);
-			GPIOPinWrite(dsPort, dsPin, dsPin);				// Back up
+			pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 			TIMER_WAIT(dsConvertTTimed, DS_WRITE_0_WAIT);
 		}
-		i <<= 1;
+		bus->bit <<= 1;
 	}
 
 	// Convert T command, 0x44
-	i = 0b00000001;	 // LSB first
-	data = 0x44;
-	while(i) {
-		GPIOPinWrite(dsPort, dsPin, 0);						// Data low
-		if(data & i) {
+	bus->bit = 0b00000001;	// LSB first
+	bus->data = 0x44;
+	while(bus->bit) {
+		pinWrite(bus->port, bus->pin, 0);					// Data low
+		if(bus->data & bus->bit) {
 			TIMER_WAIT(dsConvertTTimed, DS_WRITE_1);
-			GPIOPinWrite(dsPort, dsPin, dsPin);				// Back up
+			pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 			TIMER_WAIT(dsConvertTTimed, DS_WRITE_1_WAIT);
 		} else {
 			TIMER_WAIT(dsConvertTTimed, DS_WRITE_0);
-			GPIOPinWrite(dsPort, dsPin, dsPin);				// Back up
+			pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 			TIMER_WAIT(dsConvertTTimed, DS_WRITE_0_WAIT);
 		}
-		i <<= 1;
+		bus->bit <<= 1;
 	}
 
-	dsFlags &= ~DS_CONVERSION_DONE;							// Mark conversion started
+	bus->flags &= ~DS_CONVERSION_DONE;						// Mark conversion started
 
 	RELEASE_TIMER();
 
@@ -416,21 +430,22 @@ TIMED_FUNCTION(dsConvertTTimed)
  */
 TIMED_FUNCTION(dsConversionDoneTimed)
 {
-	TIMED_BEGIN();
+	dsBus *bus = (dsBus *)pdata;
+	TIMED_BEGIN(&bus->timed);
 
 	LOCK_TIMER();
 
-	GPIOPinWrite(dsPort, dsPin, 0);							// Data low
+	pinWrite(bus->port, bus->pin, 0);						// Data low
 	TIMER_WAIT(dsConversionDoneTimed, DS_READ_PULSE);
 
-	GPIOPinWrite(dsPort, dsPin, dsPin);						// Back up
-	GPIOPinTypeGPIOInput(dsPort, dsPin);					// Change to input and after wait read status
+	pinWrite(bus->port, bus->pin, bus->pin);				// Back up
+	GPIOPinTypeGPIOInput(bus->port, bus->pin);				// Change to input and after wait read status
 	TIMER_WAIT(dsConversionDoneTimed, DS_READ_DELAY);
 
-	if(GPIOPinRead(dsPort, dsPin))							// If read 1 conversion is done!
-		dsFlags |= DS_CONVERSION_DONE;
+	if(pinRead(bus->port, bus->pin))						// If read 1 conversion is done!
+		bus->flags |= DS_CONVERSION_DONE;
 
-	GPIOPinTypeGPIOOutputOD(dsPort, dsPin);					// Re-configure as output for next cycle
+	GPIOPinTypeGPIOOutputOD(bus->port, bus->pin);			// Re-configure as output for next cycle
 	TIMER_WAIT(dsConversionDoneTimed, DS_READ_WAIT);
 
 	RELEASE_TIMER();
@@ -446,75 +461,72 @@ TIMED_FUNCTION(dsConversionDoneTimed)
  */
 TIMED_FUNCTION(dsReadTimed)
 {
-	static uint8_t i = 1;
-	static uint8_t j = 0;
-	static uint8_t data = 0x00;
-
-	TIMED_BEGIN();
+	dsBus *bus = (dsBus *)pdata;
+	TIMED_BEGIN(&bus->timed);
 
 	LOCK_TIMER();
 
 	// Skip ROM: Write 0xCC (Only 1 device allowed on the bus!)
-	i = 0b00000001;										// LSB first
-	data = 0xCC;
-	while(i) {
-		GPIOPinWrite(dsPort, dsPin, 0);					// Data low
-		if(data & i) {
+	bus->bit = 0b00000001;								// LSB first
+	bus->data = 0xCC;
+	while(bus->bit) {
+		pinWrite(bus->port, bus->pin, 0);				// Data low
+		if(bus->data & bus->bit) {
 			TIMER_WAIT(dsReadTimed, DS_WRITE_1);
-			GPIOPinWrite(dsPort, dsPin, dsPin);			// Back up
+			pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 			TIMER_WAIT(dsReadTimed, DS_WRITE_1_WAIT);
 		} else {
 			TIMER_WAIT(dsReadTimed, DS_WRITE_0);
-			GPIOPinWrite(dsPort, dsPin, dsPin);			// Back up
+			pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 			TIMER_WAIT(dsReadTimed, DS_WRITE_0_WAIT);
 		}
-		i <<= 1;
+		bus->bit <<= 1;
 	}
 
 	// Read scratchpad command, 0xBE
-	i = 0b00000001;										// LSB first
-	data = 0xBE;
-	while(i) {
-		GPIOPinWrite(dsPort, dsPin, 0);					// Data low
-		if(data & i) {
+	bus->bit = 0b00000001;								// LSB first
+	bus->data = 0xBE;
+	while(bus->bit) {
+		pinWrite(bus->port, bus->pin, 0);				// Data low
+		if(bus->data & bus->bit) {
 			TIMER_WAIT(dsReadTimed, DS_WRITE_1);
-			GPIOPinWrite(dsPort, dsPin, dsPin);			// Back up
+			pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 			TIMER_WAIT(dsReadTimed, DS_WRITE_1_WAIT);
 		} else {
 			TIMER_WAIT(dsReadTimed, DS_WRITE_0);
-			GPIOPinWrite(dsPort, dsPin, dsPin);			// Back up
+			pinWrite(bus->port, bus->pin, bus->pin);		// Back up
 			TIMER_WAIT(dsReadTimed, DS_WRITE_0_WAIT);
 		}
-		i <<= 1;
+		bus->bit <<= 1;
 	}
 
 	// Then read 9 bytes
-	for(j=0; j<9; j++) {
-		data = 0x00;
+	for(bus->byte=0; bus->byte<9; bus->byte++) {
+		bus->data = 0x00;
 
-		i = 0b00000001;
-		while(i) {
-			GPIOPinWrite(dsPort, dsPin, 0);				// Data low
+		bus->bit = 0b00000001;
+		while(bus->bit) {
+			pinWrite(bus->port, bus->pin, 0);			// Data low
 			TIMER_WAIT(dsReadTimed, DS_READ_PULSE);
 
-			//GPIOPinWrite(dsPort, dsPin, dsPin);		// Back up
-			GPIOPinTypeGPIOInput(dsPort, dsPin);		// Change to input and after wait read status
+			//pinWrite(bus->port, bus->pin, bus->pin);		// Back up
+			GPIOPinTypeGPIOInput(bus->port, bus->pin);	// Change to input and after wait read status
 			TIMER_WAIT(dsReadTimed, DS_READ_DELAY);
 
 
-			if(GPIOPinRead(dsPort, dsPin))
-				data |= i;
+			if(pinRead(bus->port, bus->pin))
+				bus->data |= bus->bit;
 
 			TIMER_WAIT(dsReadTimed, DS_READ_WAIT);
-			GPIOPinTypeGPIOOutputOD(dsPort, dsPin);		// Re-configure as output for next cycle
-			i <<= 1;
+			GPIOPinTypeGPIOOutputOD(bus->port, bus->pin);	// Re-configure as output for next cycle
+			bus->bit <<= 1;
 		}
-		dsData.raw[j] = data;
+		bus->scratchpad.raw[bus->byte] = bus->data;
 	}
 
 	// TODO: Add CRC check?
 
-	dsFlags |= DS_DATA_VALID;							// Mark data as valid from now on
+	bus->flags |= DS_DATA_VALID;						// Mark data as valid from now on
 
 	RELEASE_TIMER();
 
@@ -528,96 +540,124 @@ static uint8_t dsDataReady = 0;
  *
  * Resets the bus, starts temperature conversion, waits until it
  * is complete and then reads the data
+ * Every bus needs a thread of its own
  */
-PT_THREAD(dsLoop(struct pt *pt))
+PT_THREAD(dsBusLoop(struct pt *pt, dsBus *bus))
 {
-	static int retries = 0;
 	PT_BEGIN(pt);
 
 	while(1) {
 		// Convert temperature
-		dsFlags &= ~DS_DATA_VALID;
+		bus->flags &= ~DS_DATA_VALID;
 
 		// Reset and check device on the bus
-		PT_WAIT_UNTIL(pt, dsResetTimed(0, CALLER_THREAD) == RETURN_DONE);
+		SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, dsResetTimed(bus, CALLER_THREAD) == RETURN_DONE);
 
-		if(dsFlags & DS_DEVICE_FOUND) {	 // Device present on the bus
+		if(bus->flags & DS_DEVICE_FOUND) {	// Device present on the bus
 
 			// Start conversion
-			PT_WAIT_UNTIL(pt, dsConvertTTimed(0, CALLER_THREAD) == RETURN_DONE);
+			SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, dsConvertTTimed(bus, CALLER_THREAD) == RETURN_DONE);
 
 			// Wait until conversion is done (TODO: Add a timeout?)
-			retries = 100;  // Check bus at least 100 times, NOTE this method does not work with parasite powered device
-			while(retries && !(dsFlags & DS_CONVERSION_DONE)) {
-				PT_WAIT_UNTIL(pt, dsConversionDoneTimed(0, CALLER_THREAD) == RETURN_DONE);
-				retries--;
+			bus->retries = 100;  // Check bus at least 100 times, NOTE this method does not work with parasite powered device
+			while(bus->retries && !(bus->flags & DS_CONVERSION_DONE)) {
+				SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, dsConversionDoneTimed(bus, CALLER_THREAD) == RETURN_DONE);
+				bus->retries--;
 			}
 
 			// TODO: Vaihtoehto: Kiinteä odotusaika
 			//commonTimer[DS_TIMER] = 1100;  // Wait 1100 ms
 			//PT_WAIT_WHILE(pt, commonTimer[DS_TIMER]);
 
-			if(dsFlags & DS_CONVERSION_DONE) {  // Conversion was done before timeout
+			if(bus->flags & DS_CONVERSION_DONE) {	// Conversion was done before timeout
 				// Read cycle: Reset, then read scratchpad
-				PT_WAIT_UNTIL(pt, dsResetTimed(0, CALLER_THREAD) == RETURN_DONE);
+				SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, dsResetTimed(bus, CALLER_THREAD) == RETURN_DONE);
 
-				PT_WAIT_UNTIL(pt, dsReadTimed(0, CALLER_THREAD) == RETURN_DONE);
+				SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, dsReadTimed(bus, CALLER_THREAD) == RETURN_DONE);
 
 				// Reset once again, we're done!
-				PT_WAIT_UNTIL(pt, dsResetTimed(0, CALLER_THREAD) == RETURN_DONE);
+				SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, dsResetTimed(bus, CALLER_THREAD) == RETURN_DONE);
 
 				// TODO: Add CRC check?
 
-				dsFlags |= DS_NEW_DATA;
+				bus->flags |= DS_NEW_DATA;
 			}
 		}
 
-		if(dsTimer) {
-			*dsTimer = DS_TIME_INTERVAL;
-			PT_WAIT_WHILE(pt, *dsTimer);
-		}
+		if(bus->period)
+			SCHED_WAIT_PERIOD(pt, bus->period);
 	}
 
 	PT_END(pt);
 }
 
+PT_THREAD(dsLoop(struct pt *pt))
+{
+	return dsBusLoop(pt, &dsDefault);
+}
+
 /**
  * Returns true if conversion is done and data is valid
  */
+uint8_t dsBusDataValid(dsBus *bus)
+{
+	return (bus->flags & DS_DATA_VALID) ? 1 : 0;
+}
+
 uint8_t dsDataValid()
 {
-	return (dsFlags & DS_DATA_VALID) ? 1 : 0;
+	return dsBusDataValid(&dsDefault);
 }
 
 /**
  * Returns true if new data is available
  */
+uint8_t dsBusNewData(dsBus *bus)
+{
+	return (bus->flags & DS_NEW_DATA) ? 1 : 0;
+}
+
 uint8_t dsNewData()
 {
-	return (dsFlags & DS_NEW_DATA) ? 1 : 0;
+	return dsBusNewData(&dsDefault);
 }
 
 /**
  * Clear the new data flag
  */
+void dsBusResetNewData(dsBus *bus)
+{
+	bus->flags &= ~DS_NEW_DATA;
+}
+
 void dsResetNewData()
 {
-	dsFlags &= ~DS_NEW_DATA;
+	dsBusResetNewData(&dsDefault);
 }
 
 /**
  * Get last conversion value (data)
  */
+uint16_t dsBusGetLastValue(dsBus *bus)
+{
+	return (bus->scratchpad.d.temperature[1] << 8) + bus->scratchpad.d.temperature[0];
+}
+
 uint16_t dsGetLastValue()
 {
-	return (dsData.d.temperature[1] << 8) + dsData.d.temperature[0];
+	return dsBusGetLastValue(&dsDefault);
 }
 
 /**
  * Get a pointer to the scrathpad memory struct
  */
+dsScratchpad *dsBusGetScratchpad(dsBus *bus)
+{
+	return &bus->scratchpad;
+}
+
 dsScratchpad *dsGetScratchpad()
 {
-	return &dsData;
+	return dsBusGetScratchpad(&dsDefault);
 }
 
@@ -7,6 +7,7 @@
 // DS18B20 returns the temperature in celsius
 
 // This version only works as single-drop, i.e. only one sensor on the bus.
+// Several buses (pins) can be used, each described by a dsBus.
 
 // With external 5k pull-up on data signal and third wire for powering.
 // Normally an open-drain output is used, but on some commands with power parameter,
@@ -69,40 +70,68 @@ typedef union _dsScratchpad {
 	} d;
 } dsScratchpad;
 
+// One 1-Wire bus and its pin
+// All state of the driver is kept here, each bus is read by a thread of its own (dsBusLoop)
+typedef struct _dsBus {
+	timedContext timed;							// State of the timed functions, used by one at a time
+	uint32_t peripheral;						// GPIO peripheral of the pin
+	uint32_t port;
+	uint32_t pin;
+	uint8_t flags;
+	uint8_t bit;								// Bit mask of the timed transfers
+	uint8_t byte;								// Byte counter of the timed read
+	uint8_t data;								// Byte being written or read
+	uint8_t retries;							// Conversion done polls left
+	dsScratchpad scratchpad;					// Latest data read from the sensor
+	periodicTimer *period;
+} dsBus;
+
+// Static initializer, pin is on the given GPIO port
+#define DS_BUS_INIT(peripheral, port, pin)	\
+	{ TIMED_CONTEXT_INIT, (peripheral), (port), (pin), 0, 0, 0, 0, 0, { { 0 } }, 0 }
+
+// The bus on PB2, used by the functions without bus parameter
+extern dsBus dsDefault;
+
 // Setup the pins and ports
+void dsBusSetup(dsBus *bus);
 void dsSetup(void);
 
+// Recover after the thread was restarted by the supervisor
+void dsBusRecover(dsBus *bus);
+void dsRecover(void);
+
 // Common 1-wire commands
 
 // Perform reset and wait for acknowledge from slave(s)
 // Returns 1 on success and 0 if nothing was found on the bus
-uint8_t dsReset(void);
+uint8_t dsReset(dsBus *bus);
 
 // Search ROM command F0h
 // TODO: Implement...
-uint8_t dsSearchRom(void);
+uint8_t dsSearchRom(dsBus *bus);
 
 // Read ROM Command 33h
 // Can be used when only 1 slave on the bus
 // Parameter must be a 64-bit buffer to store the ROM code
 // Return 1 on success, 0 on error
-uint8_t dsReadRom(dsROMCode *pROMCode);
+uint8_t dsReadRom(dsBus *bus, dsROMCode *pROMCode);
 
 // Match ROM Command 55h
 // Address a specific slave on the bus
 // Parameter must be a 64-bit buffer containing the target ROM code
 // Return 1 on success, 0 on error
-uint8_t dsMatchRom(dsROMCode *pROMCode);
+uint8_t dsMatchRom(dsBus *bus, dsROMCode *pROMCode);
 
 // Skip ROM command CCh
 // Can be used to address ALL slaves on the bus, e.g. trigger a conversion
 // Only on single-drop systems may a read command follow this command
-void dsSkipRom(void);
+void dsSkipRom(dsBus *bus);
 
 // Alarm Search ECh
 // Same as search ROM but only devices with alarm flag set will respond
 // Returns 1 on success, 0 on error
-uint8_t dsAlarmSearch(dsROMCode *pROMCode);
+uint8_t dsAlarmSearch(dsBus *bus, dsROMCode *pROMCode);
 
 
 // DS18B20 specific commands
@@ -113,54 +142,60 @@ uint8_t dsAlarmSearch(dsROMCode *pROMCode);
 // Set power = 2 to wait until conversion is done (TODO: Not done)
 // TODO: Blocking until done if power=1?
 // Returns 0 on error (no device on bus), otherwise nonzero
-uint8_t dsConvertT(uint8_t power);
+uint8_t dsConvertT(dsBus *bus, uint8_t power);
 
 // Check if conversion is done; dsConvertT must be called before this, otherwise behaviour is undefined
 // returns 0xFF when conversion is done, 0 otherwise
-uint8_t dsConversionDone(void);
+uint8_t dsConversionDone(dsBus *bus);
 
 // Write scratchpad 4Eh
 // Write Th and Tl and conf registers to the chip
-void dsWrite(uint8_t Th, uint8_t Tl, uint8_t conf);
+void dsWrite(dsBus *bus, uint8_t Th, uint8_t Tl, uint8_t conf);
 
 // Read scratchpad BEh
 // Read contents of the memory
 // Parameter must be a 9-byte buffer containing following data in byte-order:
 // 0 - Temperature LSB, MSB, Th, Tl, conf, res, res, res, CRC
 // Returns 1 on success and 0 on error
-uint8_t dsRead(dsScratchpad *pData);
+uint8_t dsRead(dsBus *bus, dsScratchpad *pData);
 
 // Copy scratchpad 48h
 // Copies Th, Tl and conf registers to eeprom
 // power = 1 keeps output high afterwards for parasitic powered devices.
 // TODO: Blocking for 10 ms until copy is done if power=1?
-void dsCopy(uint8_t power);
+void dsCopy(dsBus *bus, uint8_t power);
 
 // Recall EEPROM B8h
 // Copy Th, Tl and conf from EEPROM to scratchpad
-void dsRecall(void);
+void dsRecall(dsBus *bus);
 
 
 // Read power supply B4h
 // Check whether chip is powered parasitically or not
 // Returns 1 if power supply is used, 2 if parasitically and 0 if no devices on the bus
-uint8_t dsReadPower(void);
+uint8_t dsReadPower(dsBus *bus);
 
 // Other functions
 uint8_t dsCalculateCRC(void);
 
 // Main loop
+PT_THREAD(dsBusLoop(struct pt *pt, dsBus *bus));
 PT_THREAD(dsLoop(struct pt *pt));
 
 // Returns 1 if data is valid (i.e. conversion not running)
+uint8_t dsBusDataValid(dsBus *bus);
 uint8_t dsDataValid();
 // Returns 1 if new data since last reset (value reset)
+uint8_t dsBusNewData(dsBus *bus);
 uint8_t dsNewData();
 // Reset new data flag
+void dsBusResetNewData(dsBus *bus);
 void dsResetNewData();
 // Return the latest conversion result in fixed point 12.4 (i.e. divide by 16.0 to get temp in Celsius)
+uint16_t dsBusGetLastValue(dsBus *bus);
 uint16_t dsGetLastValue();
 // Return address of the scratcpad
+dsScratchpad *dsBusGetScratchpad(dsBus *bus);
 dsScratchpad * dsGetScratchpad();
 
 #endif
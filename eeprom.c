@@ -17,8 +17,12 @@ typedef uint8_t bool;
 #include "driverlib/gpio.h"
 #include "driverlib/eeprom.h"
 
+#include "pt.h"
+
 #include "common.h"
+#include "sched.h"
 #include "eeprom.h"
+#include "trace.h"
 
 static uint8_t eOK = 0;							// EEPROM ok? 1= ok, 0 = fail
 static uint32_t eSize;								// EEPROM Size
@@ -29,6 +33,20 @@ static uint8_t nextNum = 0;
 
 //eConfig eepromConfig;
 
+/**
+ * Read data block at real address, blocks of another layout version
+ * read as erased, i.e. all 0xFF and n = 0xFF
+ */
+static void _eReadBlock(eData *data, uint32_t addr)
+{
+	uint8_t *p = (uint8_t *)data;
+	uint8_t i;
+
+	EEPROMRead(data, addr, sizeof(eData));
+	if(data->version != EEPROM_EDATA_VERSION)
+		for(i=0; i < sizeof(eData); i++) p[i] = 0xFF;
+}
+
 /**
  * Find next block in EEPROM to write to after system boot
  *
@@ -37,7 +55,8 @@ static uint8_t nextNum = 0;
  *
  * Case 1: Find the largest index, free is the next one, EXCEPT when
  * Case 2: largest is 254 and next is 0, which means overflow, find the largest continuous one, free is then next one
- * Case 3: IF item is 255, that is empty block (eeprom reset value)
+ * Case 3: IF item is 255, that is empty block (eeprom reset value),
+ *         also blocks of an older layout version are empty
  */
 void _eFindNextBlock(void)
 {
@@ -49,7 +68,7 @@ void _eFindNextBlock(void)
 
 	for(i=0; i < EEPROM_DATA_BLOCKS; i++)
 	{
-		EEPROMRead(&block, addr, sizeof(eData));
+		_eReadBlock(&block, addr);
 		currentNum = block.n;
 		if(i == 0) prevNum = currentNum;
 
@@ -100,13 +119,18 @@ void _eFindNextBlock(void)
 }
 
 /**
- * Initialize EEPROM peripheral
- * Also searches for next block number to write to, if initialization was OK.
+ * Initialize EEPROM peripheral in the background
+ * EEPROMInit is retried up to 200 times, waiting 30 ms on timer in between,
+ * so the other threads keep running. With a valid cursor saved before a warm
+ * restart the write position is taken from it, otherwise the data area is
+ * searched for the next block to write to.
+ * eIsOK() tells the result after the thread has ended.
  */
-uint8_t eInit(void)
+PT_THREAD(eInitThread(struct pt *pt, threadTimer *timer, const eCursor *cursor))
 {
-	uint8_t i;
-	uint32_t ret;
+	static uint8_t tries;
+
+	PT_BEGIN(pt);
 
 	if(!SysCtlPeripheralReady(SYSCTL_PERIPH_EEPROM0))
 	{
@@ -114,29 +138,43 @@ uint8_t eInit(void)
 		while(!SysCtlPeripheralReady(SYSCTL_PERIPH_EEPROM0));
 	}
 
-	// Try to init max 200 times
-	for(i=0; i<200; i++) {
-		ret = EEPROMInit();
-		if(ret == EEPROM_INIT_OK)
+	eOK = 0;
+	for(tries=0; tries<200; tries++) {
+		if(EEPROMInit() == EEPROM_INIT_OK) {
+			eOK = 1;
 			break;
-		else
-			SysCtlDelay(SysCtlClockGet()/100);			// Wait a while...
+		}
+
+		// Wait a while...
+		if(timer) {
+			timerStart(timer, 30);
+			SCHED_WAIT_TIMER(pt, timer);
+		} else {
+			delayMillisec(30);
+		}
 	}
 
 	// If eeprom init failed every time...
-	if(ret != EEPROM_INIT_OK) {
-		eOK = 0;
-		return 1;  // Fail
-	}
+	if(!eOK) PT_EXIT(pt);
 
-	eOK = 1;
 	eSize = EEPROMSizeGet();
 	eBlocks = EEPROMBlockCountGet();
 
-	// Find address of next free block, try not to overwrite old ones if possible after reset
-	_eFindNextBlock();
+	if(cursor && cursor->block < EEPROM_DATA_BLOCKS && cursor->num < EEPROM_MAX_N) {
+		nextBlock = cursor->block;
+		nextNum = cursor->num;
+	} else {
+		// Find address of next free block, try not to overwrite old ones if possible after reset
+		_eFindNextBlock();
+	}
 
-	return 0;
+	PT_END(pt);
+}
+
+void eGetCursor(eCursor *cursor)
+{
+	cursor->block = nextBlock;
+	cursor->num = nextNum;
 }
 
 /**
@@ -154,8 +192,14 @@ uint8_t eReadConfig(eConfig *conf)
  */
 uint8_t eWriteConfig(eConfig *conf)
 {
+	uint32_t ret;
 	if(!eOK) return 1;									// Eeprom not initialized
-	return EEPROMProgram(conf, EEPROM_CONF_LOC, sizeof(eConfig));
+
+	TRACE_EVENT(TRACE_EEPROM_CONFIG, 0);
+	ret = EEPROMProgram(conf, EEPROM_CONF_LOC, sizeof(eConfig));
+	if(ret) TRACE_EVENT(TRACE_EEPROM_FAIL, ret);
+
+	return ret;
 }
 
 /**
@@ -168,8 +212,11 @@ uint8_t eWriteData(eData *data)
 	uint32_t ret;
 	if(!eOK) return 1;									// Eeprom not initialized
 
+	data->version = EEPROM_EDATA_VERSION;
 	data->n = nextNum;
+	TRACE_EVENT(TRACE_EEPROM_WRITE, nextBlock);
 	ret = EEPROMProgram(data, EEPROM_DATA_LOC + nextBlock * EEPROM_EDATA_SIZE, sizeof(eData));
+	if(ret) TRACE_EVENT(TRACE_EEPROM_FAIL, ret);
 
 	nextNum = (nextNum + 1) % EEPROM_MAX_N;
 	nextBlock++;
@@ -187,7 +234,7 @@ uint8_t eReadData(eData *data, uint8_t addr)
 {
 	if(!eOK) return 1;  // Eeprom not initialized
 	if(addr >= EEPROM_DATA_BLOCKS) return 2; // Read out of bounds
-	EEPROMRead(data, EEPROM_DATA_LOC + addr * EEPROM_EDATA_SIZE, sizeof(eData));
+	_eReadBlock(data, EEPROM_DATA_LOC + addr * EEPROM_EDATA_SIZE);
 	return 0;
 }
 
@@ -14,17 +14,23 @@ typedef struct __attribute__((__packed__)) _eConfig {
 } eConfig;
 
 // Structure that contains the data to be stored
-// Size is 16 bytes, MUST BE MULTIPLE OF 4
+// Size is 24 bytes, MUST BE MULTIPLE OF 4
 // Packing should be done properly if possible, to have everything lay out nicely on 4 byte boundaries...
 // N is written last, so that if write is interrupted, the segment will be reused next time
-#define EEPROM_EDATA_SIZE 16
+// Blocks without the current version were written with another layout (e.g. the
+// earlier 16 byte blocks) and are read as empty
+#define EEPROM_EDATA_SIZE 24
+#define EEPROM_EDATA_VERSION 0xA1			// Not a small number, old 16 byte blocks have 0 or the high byte of a 12-bit value there
 typedef struct __attribute__((__packed__)) _eData {
 	int32_t weight;							// Weight in ADC units
 	uint16_t temperature;					// External temperature
 	uint16_t ethanol;						// Ethanol sensor reading
 	uint32_t bubble;						// Bubbling sensor integral
 	uint16_t co2;							// Co2 volume sensor integral (ie. times flushed)
-	uint8_t reserved;						// Spare
+	uint16_t bubbleRate;					// Bubbles per minute [0.1 / min]
+	uint32_t bubbles;						// Bubbles counted
+	uint16_t bubbleLength;					// Length of the latest bubble [ms]
+	uint8_t version;						// EEPROM_EDATA_VERSION, set by eWriteData
 	uint8_t n;								// Number of the data segment that was stored, max is 254, since 255 denotes empty EEPROM
 } eData;
 
@@ -49,9 +55,19 @@ typedef struct __attribute__((__packed__)) _eData {
 #error "EEPROM: Total storage exceeds EEPROM size"
 #endif
 
-// Initialize EEPROM and recover from failures
-// Return 0 if everything ok, nonzero if there is a failure
-uint8_t eInit(void);
+// Write position of the data area, kept over warm restarts (warm.h)
+typedef struct _eCursor {
+	uint8_t block;							// Next data block to write
+	uint8_t num;							// Number of the next data block
+} eCursor;
+
+// Initialize EEPROM and recover from failures, run as a child protothread
+// Continues writing at cursor if it is valid (warm restart), otherwise the
+// data area is searched. Retries wait on timer. Result is given by eIsOK()
+PT_THREAD(eInitThread(struct pt *pt, threadTimer *timer, const eCursor *cursor));
+
+// Get the current write position
+void eGetCursor(eCursor *cursor);
 
 // Read configuration
 // Return 0 on success
@@ -66,6 +82,7 @@ uint8_t eWriteConfig(eConfig *config);
 uint8_t eWriteData(eData *data);
 
 // Read data from index "addr"
+// A block of another layout version reads as an empty (erased) block
 uint8_t eReadData(eData *data, uint8_t addr);
 
 // Read byte from EEPROM, returns 0 if ok, 1 if eeprom is not ready, 2 if outside bounds, 3 if address is not divisible by 4
@@ -0,0 +1,151 @@
+/**
+ * Fixed-point CIC decimator and FIR filter, see filter.h
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+#include <string.h>
+typedef uint8_t bool;
+
+#include "filter.h"
+
+
+// Windowed sinc (Hamming), sums to 32768
+const int16_t filterLowpass8[8] __attribute__ ((aligned(4))) = {
+	287, 1571, 5375, 9151, 9151, 5375, 1571, 287 };
+
+
+#ifdef __ARM_FEATURE_DSP
+
+// acc + x.lo * h.lo + x.hi * h.hi, two signed 16-bit products in one instruction
+static inline int32_t _filterMac2(uint32_t x, uint32_t h, int32_t acc)
+{
+	int32_t result;
+	__asm__ ("smlad %0, %1, %2, %3" : "=r" (result) : "r" (x), "r" (h), "r" (acc));
+	return result;
+}
+
+// Saturate to int16
+static inline int16_t _filterSat16(int32_t x)
+{
+	int32_t result;
+	__asm__ ("ssat %0, #16, %1" : "=r" (result) : "r" (x));
+	return (int16_t)result;
+}
+
+#else
+
+static inline int32_t _filterMac2(uint32_t x, uint32_t h, int32_t acc)
+{
+	return acc + (int32_t)(int16_t)(x & 0xFFFF) * (int16_t)(h & 0xFFFF) +
+		(int32_t)(int16_t)(x >> 16) * (int16_t)(h >> 16);
+}
+
+static inline int16_t _filterSat16(int32_t x)
+{
+	if(x > 32767) return 32767;
+	if(x < -32768) return -32768;
+	return (int16_t)x;
+}
+
+#endif
+
+
+void filterInit(filter *f, uint8_t order, uint8_t rateShift, const int16_t *coef, uint8_t taps)
+{
+	uint8_t i;
+
+	if(order > FILTER_CIC_ORDER_MAX) order = FILTER_CIC_ORDER_MAX;
+	if(taps > FILTER_FIR_TAPS_MAX) taps = FILTER_FIR_TAPS_MAX;
+	if(!coef) taps = 0;
+
+	f->order = order;
+	f->rateShift = order ? rateShift : 0;
+	f->phase = 0;
+	f->coef = coef;
+	f->taps = taps & ~1;
+	f->pos = 0;
+
+	// CIC stages after the first one and the FIR start from zero history
+	f->settle = (order ? order - 1 : 0) + (f->taps ? f->taps - 1 : 0);
+
+	for(i=0; i < FILTER_CIC_ORDER_MAX; i++) {
+		f->integrator[i] = 0;
+		f->comb[i] = 0;
+	}
+	for(i=0; i < 2 * FILTER_FIR_TAPS_MAX; i++)
+		f->delay[i] = 0;
+}
+
+/**
+ * Integrators run at the input rate, combs and the FIR at the output rate.
+ * Pairs of delay line samples and coefficients are loaded as words
+ * (unaligned loads are allowed on the M4) for the dual multiply-accumulate
+ */
+static inline uint8_t _filterPut(filter *f, uint16_t sample, int16_t *out)
+{
+	uint8_t i;
+	uint32_t x = sample;
+	uint32_t prev;
+	uint32_t xPair, hPair;
+	int32_t acc;
+	int16_t y;
+
+	// CIC decimator
+	if(f->order) {
+		for(i=0; i < f->order; i++) {
+			f->integrator[i] += x;
+			x = f->integrator[i];
+		}
+		if(++f->phase < (1 << f->rateShift)) return 0;
+		f->phase = 0;
+
+		for(i=0; i < f->order; i++) {
+			prev = f->comb[i];
+			f->comb[i] = x;
+			x -= prev;
+		}
+		x >>= f->order * f->rateShift;
+	}
+	y = (int16_t)x;
+
+	// FIR, newest sample first
+	if(f->taps) {
+		f->pos = f->pos ? f->pos - 1 : f->taps - 1;
+		f->delay[f->pos] = y;
+		f->delay[f->pos + f->taps] = y;
+
+		acc = 0;
+		for(i=0; i < f->taps; i += 2) {
+			memcpy(&xPair, &f->delay[f->pos + i], 4);
+			memcpy(&hPair, &f->coef[i], 4);
+			acc = _filterMac2(xPair, hPair, acc);
+		}
+		y = _filterSat16(acc >> 15);
+	}
+
+	if(f->settle) {
+		f->settle--;
+		return 0;
+	}
+
+	*out = y;
+	return 1;
+}
+
+uint8_t filterPut(filter *f, uint16_t sample, int16_t *out)
+{
+	return _filterPut(f, sample, out);
+}
+
+uint16_t filterBlock(filter *f, const uint16_t *in, uint16_t n, int16_t *out)
+{
+	uint16_t i;
+	uint16_t outputs = 0;
+
+	for(i=0; i < n; i++)
+		outputs += _filterPut(f, in[i], &out[outputs]);
+
+	return outputs;
+}
@@ -0,0 +1,48 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+// Fixed-point decimation filter for ADC samples
+//
+// A CIC (cascaded integrator-comb) decimator of order N reduces the rate
+// by R = 2^rateShift with only additions, then an optional short FIR with
+// Q15 coefficients shapes the pass band. Gain is 1 at DC: the CIC gain R^N
+// is shifted out and the FIR coefficients must sum to 32768.
+//
+// The FIR multiplies two taps per SMLAD instruction on the Cortex-M4 and
+// saturates with SSAT. Other targets (the host, see tools/filterbench.c)
+// use C code that gives the same results.
+//
+// Input is an unsigned 12-bit ADC value, so 12 + N * rateShift must not be
+// more than 32 bits. The first outputs, until the filter has seen enough
+// input to fill its history, are not given out.
+
+#define FILTER_CIC_ORDER_MAX		3
+#define FILTER_FIR_TAPS_MAX			16				// Must be even
+
+// Filter state, set up with filterInit()
+typedef struct _filter {
+	uint8_t order;							// CIC order N, 0 = no decimation
+	uint8_t rateShift;						// Decimation R = 2^rateShift
+	uint8_t phase;							// Inputs since the last CIC output
+	uint8_t settle;							// Outputs to drop until the history is full
+	uint32_t integrator[FILTER_CIC_ORDER_MAX];	// Wrap around, the differences are still right
+	uint32_t comb[FILTER_CIC_ORDER_MAX];		// Previous input of each comb stage
+	const int16_t *coef;					// FIR coefficients [Q15], 0 = no FIR
+	uint8_t taps;							// Even number of coefficients
+	uint8_t pos;							// Newest sample in the delay line
+	int16_t delay[2 * FILTER_FIR_TAPS_MAX];	// Delay line twice, so the taps are always contiguous
+} filter;
+
+// Low pass FIR, 8 taps, cut-off at 0.1 of the output rate
+extern const int16_t filterLowpass8[8];
+
+// Set up the filter, taps must be even (pad with a zero coefficient)
+void filterInit(filter *f, uint8_t order, uint8_t rateShift, const int16_t *coef, uint8_t taps);
+
+// Feed one sample, returns 1 and the filtered value in out when an output is ready
+uint8_t filterPut(filter *f, uint16_t sample, int16_t *out);
+
+// Feed n samples, writes up to (n >> rateShift) + 1 outputs, returns the number of outputs
+uint16_t filterBlock(filter *f, const uint16_t *in, uint16_t n, int16_t *out);
+
+#endif
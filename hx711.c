@@ -14,6 +14,7 @@ typedef uint8_t bool;
 #include "inc/tm4c123gh6pm.h"
 #include "inc/hw_types.h"
 #include "inc/hw_memmap.h"
+#include "inc/hw_gpio.h"
 
 #include "driverlib/sysctl.h"
 #include "driverlib/gpio.h"
@@ -23,64 +24,82 @@ typedef uint8_t bool;
 #include "pt.h"
 
 #include "common.h"
+#include "sched.h"
+#include "resource.h"
+#include "profile.h"
+#include "trace.h"
+#include "pin.h"
+#include "power.h"
 #include "hx711.h"
 
-// Port & pin mappings
-const uint32_t hx711Peripheral = SYSCTL_PERIPH_GPIOB;
-const uint32_t hx711Port = GPIO_PORTB_BASE;
-const uint32_t hx711ClockPin = GPIO_PIN_0;					// PB0 = clock
-const uint32_t hx711DataPin = GPIO_PIN_1;					// PB1 = data
-
-static uint8_t hx711Channel = 25;							// 25 = channel A gain 128, 26 = B gain 32, 27 = A gain 64, others = error/undefined
-//uint8_t hx711Sleeping = 0;								// 0 = not sleeping, 1 = sleeping
-
-static int32_t hx711Value = 0;								// Measured weight after oversampling
-static int32_t hx711LastData = 0;							// Latest conversion result
-static volatile uint32_t hx711ConversionData = 0;
-
-static uint8_t hx711Flags = 0;
-
-// Timer
-uint32_t *hx711Timer;
+// Port & pin mappings of the default scale, PB0 = clock, PB1 = data
+hx711Device hx711Default = HX711_DEVICE_INIT(SYSCTL_PERIPH_GPIOB, GPIO_PORTB_BASE, GPIO_PIN_0, GPIO_PIN_1);
 
 /**
  * Setup peripherals and pins required for HX711 communications
  * Communication is done by software
  */
-void hx711Setup(void)
+void hx711DeviceSetup(hx711Device *dev)
 {
 	// Enable output GPIO peripheral if not yet enabled
-	if(!SysCtlPeripheralReady(hx711Peripheral))
+	if(!SysCtlPeripheralReady(dev->peripheral))
 	{
-		SysCtlPeripheralEnable(hx711Peripheral);
-		while(!SysCtlPeripheralReady(hx711Peripheral));
+		SysCtlPeripheralEnable(dev->peripheral);
+		while(!SysCtlPeripheralReady(dev->peripheral));
 	}
 
 	// Initialize pin types and set values
-	GPIOPinTypeGPIOOutput(hx711Port, hx711ClockPin);
-	GPIOPinWrite(hx711Port, hx711ClockPin, hx711ClockPin);  // Clock 1 = reset
+	GPIOPinTypeGPIOOutput(dev->port, dev->clockPin);
+	pinWrite(dev->port, dev->clockPin, dev->clockPin);		// Clock 1 = reset
 
-	GPIOPinTypeGPIOInput(hx711Port, hx711DataPin);
+	GPIOPinTypeGPIOInput(dev->port, dev->dataPin);
 
 	//hx711Sleeping = 1;
-	hx711Flags |= HX711_SLEEPING;
+	dev->flags |= HX711_SLEEPING;
 
-	delayMicrosec(60);										// > 60 us clock pulse high sets sleep mode and resets hx711
+	// > 60 us clock pulse high sets sleep mode and resets hx711
+	// Not waited for here, the thread waits a full period before waking it
 	
-	hx711Timer = getFreeTimer();
+	dev->period = getFreePeriodic(HX711_TIME_INTERVAL);
+}
+
+void hx711Setup(void)
+{
+	hx711DeviceSetup(&hx711Default);
+}
+
+/**
+ * Thread was restarted by the supervisor, e.g. scale was unplugged
+ * Aborts the timed function in progress and resets the hx711 with a long
+ * clock pulse, the restarted thread wakes it up again
+ */
+void hx711DeviceRecover(hx711Device *dev)
+{
+	timedAbort(&dev->timed);
+
+	pinWrite(dev->port, dev->clockPin, dev->clockPin);		// Clock 1 = reset
+	dev->flags &= ~HX711_DATA_VALID;
+	dev->flags |= HX711_SLEEPING;
+	delayMicrosec(60);
+	powerSetState(POWER_HX711, POWER_SLEEP);
+}
+
+void hx711Recover(void)
+{
+	hx711DeviceRecover(&hx711Default);
 }
 
 /**
  * Set the channel to be used (0, 1 or 2)
  * Returns the previous channel used (0, 1 or 2)
  */
-uint8_t hx711SetChannel(uint8_t ch)
+uint8_t hx711SetChannel(hx711Device *dev, uint8_t ch)
 {
-	uint8_t oldChannel = hx711Channel;
+	uint8_t oldChannel = dev->channel;
 
-	if(ch == 0) hx711Channel = 25;
-	else if(ch == 1) hx711Channel = 26;
-	else hx711Channel = 27;
+	if(ch == 0) dev->channel = 25;
+	else if(ch == 1) dev->channel = 26;
+	else dev->channel = 27;
 
 	if(oldChannel == 25) return 0;
 	else if(oldChannel == 26) return 1;
@@ -91,38 +110,38 @@ uint8_t hx711SetChannel(uint8_t ch)
  * Check if hx711 has valid data to be read
  * Returns 1 if data is ready, otherwise 0
  */
-uint8_t hx711DataReady(void)
+uint8_t hx711DataReady(hx711Device *dev)
 {
 	// Data pin high means data is not ready
-	return GPIOPinRead(hx711Port, hx711DataPin) ? 0 : 1;
+	return pinRead(dev->port, dev->dataPin) ? 0 : 1;
 }
 
 /**
  * Read last conversion result  from hx711
  * Blocking function
  */
-int32_t hx711ReadData(void)
+int32_t hx711ReadData(hx711Device *dev)
 {
 	uint8_t clocks;
 	uint32_t data = 0;
 	bool bInt;
 
-	if(hx711Flags & HX711_SLEEPING)
-		hx711SleepOff(1);
+	if(dev->flags & HX711_SLEEPING)
+		hx711SleepOff(dev, 1);
 
   // Disable interrupts to make sure clocking is correct
   //bInt = IntMasterDisable();
 
-	for(clocks = hx711Channel; clocks > 0; clocks--) {
+	for(clocks = dev->channel; clocks > 0; clocks--) {
 		// Clock high
-		GPIOPinWrite(hx711Port, hx711ClockPin, hx711ClockPin);
+		pinWrite(dev->port, dev->clockPin, dev->clockPin);
 		delayMicrosec(HX711_CLOCK_TIME);
 
 		// Read bit
-		data = (data << 1) + (GPIOPinRead(hx711Port, hx711DataPin) ? 1 : 0);
+		data = (data << 1) + (pinRead(dev->port, dev->dataPin) ? 1 : 0);
 
 		// Clock low
-		GPIOPinWrite(hx711Port, hx711ClockPin, 0);
+		pinWrite(dev->port, dev->clockPin, 0);
 		delayMicrosec(HX711_CLOCK_TIME);
 	}
 
@@ -135,21 +154,21 @@ int32_t hx711ReadData(void)
 /**
  * Put hx711 to sleep mode
  */
-void hx711SleepOn(void)
+void hx711SleepOn(hx711Device *dev)
 {
-	GPIOPinWrite(hx711Port, hx711ClockPin, hx711ClockPin);  // Clock high > 60 us
+	pinWrite(dev->port, dev->clockPin, dev->clockPin);		// Clock high > 60 us
 	delayMicrosec(HX711_SLEEP_TIME);
-	hx711Flags |= HX711_SLEEPING;
+	dev->flags |= HX711_SLEEPING;
 }
 
 /**
  * Wake hx711 up from sleep mode
  */
-void hx711SleepOff(uint8_t block)
+void hx711SleepOff(hx711Device *dev, uint8_t block)
 {
-	GPIOPinWrite(hx711Port, hx711ClockPin, 0);  // Clock low
+	pinWrite(dev->port, dev->clockPin, 0);		// Clock low
 	if(block) delayMillisec(HX711_SETTLING_TIME);	   // Maximum time before conversion is stable (10 Hz mode; 80 Hz mode only 50 ms)
-	hx711Flags &= ~HX711_SLEEPING;
+	dev->flags &= ~HX711_SLEEPING;
 }
 
 
@@ -157,65 +176,65 @@ void hx711SleepOff(uint8_t block)
 // TODO: -> Sallii sitten useamman luvun peräkkäin helposti
 /**
  * Read conversion data from hx711 using a non-blocking function 
- * i.e. a timed function
+ * i.e. a timed function, pdata is the device
  */
 TIMED_FUNCTION(hx711ReadTimed)
 {
-	static uint8_t clocks = 0;
-	TIMED_BEGIN();
+	hx711Device *dev = (hx711Device *)pdata;
+	TIMED_BEGIN(&dev->timed);
 
 	// Wait until timer is free, then lock it
 	LOCK_TIMER();
 
 	// Wake up from sleep mode if sleeping
 	/*
-	if(hx711Flags & HX711_SLEEPING) {
-		GPIOPinWrite(hx711Port, hx711ClockPin, 0);	// Clock low
+	if(dev->flags & HX711_SLEEPING) {
+		pinWrite(dev->port, dev->clockPin, 0);		// Clock low
 		TIMER_WAIT(hx711ReadTimed, HX711_SETTLING_TIME*1000);	 // Time in ms, wait in us
-		hx711Flags &= ~HX711_SLEEPING;
+		dev->flags &= ~HX711_SLEEPING;
 	}*/
 
 	// Check and wait until data is ready
-	clocks = HX711_RETRIES;
-	while(clocks & !hx711DataReady()) {
+	dev->clocks = HX711_RETRIES;
+	while(dev->clocks & !hx711DataReady(dev)) {
 		TIMER_WAIT(hx711ReadTimed, HX711_WAIT_TIME);
-		clocks--;
+		dev->clocks--;
 	}
 
 	// Did not time out, i.e. retries were left over
-	if(clocks) {
-		for(clocks = hx711Channel; clocks > 0; clocks--) {
+	if(dev->clocks) {
+		for(dev->clocks = dev->channel; dev->clocks > 0; dev->clocks--) {
 			// Clock high
-			GPIOPinWrite(hx711Port, hx711ClockPin, hx711ClockPin);
+			pinWrite(dev->port, dev->clockPin, dev->clockPin);
 			TIMER_WAIT(hx711ReadTimed, HX711_CLOCK_TIME);
 
 			// Read bit
-			hx711ConversionData = (hx711ConversionData << 1) + (GPIOPinRead(hx711Port, hx711DataPin) ? 1 : 0);
+			dev->conversionData = (dev->conversionData << 1) + (pinRead(dev->port, dev->dataPin) ? 1 : 0);
 
 			// Clock low
-			GPIOPinWrite(hx711Port, hx711ClockPin, 0);
+			pinWrite(dev->port, dev->clockPin, 0);
 			TIMER_WAIT(hx711ReadTimed, HX711_CLOCK_TIME);
 		}
 
 		// Scale output to 32 bits and MSB is sign bit -> cast to signed and return
 		// TODO: Muuta skaalaus niin että on signed + 15 bittiä eikä s+31.
 		// Sallii sitten oversamplayksen myöhemmin.
-		//hx711LastData = (int32_t)(hx711ConversionData << 8);
+		//dev->lastData = (int32_t)(dev->conversionData << 8);
 		// Convert 24 bit signed integer to a 32 bit signed integer (i.e. two's complement)
-		//hx711LastData = (int32_t)((hx711ConversionData & 0x800000) ? (0xFF000000 | hx711ConversionData) : hx711ConversionData);
+		//dev->lastData = (int32_t)((dev->conversionData & 0x800000) ? (0xFF000000 | dev->conversionData) : dev->conversionData);
 
 		// NOTE! The behaviour is undefined by C standard, so most likely not portable :)
-		hx711LastData = ((int32_t)(hx711ConversionData << 8)) >> 8;		// TODO: Testaa että menee aritmeettisesti oikein!
+		dev->lastData = ((int32_t)(dev->conversionData << 8)) >> 8;		// TODO: Testaa että menee aritmeettisesti oikein!
 
-		hx711Flags |= HX711_DATA_VALID;
+		dev->flags |= HX711_DATA_VALID;
 	}
 
 	// If read time interval is long enough, put sensor to sleep mode
 	/*
 	if(HX711_TIME_INTERVAL > HX711_SLEEP_THRESHOLD) {
-		GPIOPinWrite(hx711Port, hx711ClockPin, hx711ClockPin);	// Clock high > 60 us
+		pinWrite(dev->port, dev->clockPin, dev->clockPin);		// Clock high > 60 us
 		TIMER_WAIT(hx711ReadTimed, HX711_SLEEP_TIME);
-		hx711Flags |= HX711_SLEEPING;
+		dev->flags |= HX711_SLEEPING;
 	}*/
 
 	RELEASE_TIMER();
@@ -229,11 +248,12 @@ TIMED_FUNCTION(hx711ReadTimed)
  */
 TIMED_FUNCTION(hx711SleepOnTimed)
 {
-	TIMED_BEGIN();
+	hx711Device *dev = (hx711Device *)pdata;
+	TIMED_BEGIN(&dev->timed);
 	LOCK_TIMER();
-	GPIOPinWrite(hx711Port, hx711ClockPin, hx711ClockPin);	// Clock high > 60 us
+	pinWrite(dev->port, dev->clockPin, dev->clockPin);		// Clock high > 60 us
 	TIMER_WAIT(hx711SleepOnTimed, HX711_SLEEP_TIME);
-	hx711Flags |= HX711_SLEEPING;
+	dev->flags |= HX711_SLEEPING;
 	RELEASE_TIMER();
 	TIMED_END();
 }
@@ -244,12 +264,13 @@ TIMED_FUNCTION(hx711SleepOnTimed)
  */
  TIMED_FUNCTION(hx711SleepOffTimed)
  {
-	TIMED_BEGIN();
-	if(hx711Flags & HX711_SLEEPING) {
+	hx711Device *dev = (hx711Device *)pdata;
+	TIMED_BEGIN(&dev->timed);
+	if(dev->flags & HX711_SLEEPING) {
 		LOCK_TIMER();
-		GPIOPinWrite(hx711Port, hx711ClockPin, 0);	// Clock low
+		pinWrite(dev->port, dev->clockPin, 0);		// Clock low
 		TIMER_WAIT(hx711SleepOffTimed, HX711_SETTLING_TIME*1000);	 // Time in ms, wait in us
-		hx711Flags &= ~HX711_SLEEPING;
+		dev->flags &= ~HX711_SLEEPING;
 		RELEASE_TIMER();
 	}
 	TIMED_END();
@@ -258,45 +279,46 @@ TIMED_FUNCTION(hx711SleepOnTimed)
 
 /**
  * Main loop to read data from hx711 weigh scale sensor
+ * Every device needs a thread of its own
  */
-PT_THREAD(hx711Loop(struct pt *pt))
+PT_THREAD(hx711DeviceLoop(struct pt *pt, hx711Device *dev))
 {
-	static uint8_t samples;
 	PT_BEGIN(pt);
 
 	while(1)
 	{
-		if(hx711Timer) {
-			*hx711Timer = HX711_TIME_INTERVAL;
-			PT_WAIT_WHILE(pt, *hx711Timer);
-		}
+		if(dev->period)
+			SCHED_WAIT_PERIOD(pt, dev->period);
 
-		hx711Flags &= ~HX711_DATA_VALID;
+		dev->flags &= ~HX711_DATA_VALID;
 
 		// Wake up from sleep mode if sleeping
-		PT_WAIT_UNTIL(pt, hx711SleepOffTimed(0, CALLER_THREAD) == RETURN_DONE);		// Timed call
+		SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, hx711SleepOffTimed(dev, CALLER_THREAD) == RETURN_DONE);		// Timed call
+		powerSetState(POWER_HX711, POWER_ACTIVE);
 
-		samples = HX711_SAMPLES;
-		hx711Value = 0;
+		dev->samples = HX711_SAMPLES;
+		dev->value = 0;
 		do {
-			// Wait until conversion data is ready
-			PT_WAIT_UNTIL(pt, hx711DataReady());
+			// Wait until conversion data is ready, data pin is checked on every tick
+			SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TICK, hx711DataReady(dev));
 			// Start conversion and wait for result
-			PT_WAIT_UNTIL(pt, hx711ReadTimed(0, CALLER_THREAD) == RETURN_DONE);			// Timed call
-			// hx711LastData = hx711ReadData();	// Blocking call
+			SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, hx711ReadTimed(dev, CALLER_THREAD) == RETURN_DONE);			// Timed call
+			// dev->lastData = hx711ReadData(dev);	// Blocking call
 			
-			hx711Value += hx711LastData;
+			dev->value += dev->lastData;
 
 			PT_YIELD(pt);						// Yield in between reads
-			samples--;
-		} while(samples);
+			dev->samples--;
+		} while(dev->samples);
 		
-		if(hx711Flags & HX711_DATA_VALID)		// Conversion was succesfull
-		hx711Flags |= HX711_NEW_DATA;
+		if(dev->flags & HX711_DATA_VALID)		// Conversion was succesfull
+		dev->flags |= HX711_NEW_DATA;
 		
-		// Put hx711 to sleep mode if delay between reads is long enough
-		if(HX711_TIME_INTERVAL > HX711_SLEEP_THRESHOLD) {
-			PT_WAIT_UNTIL(pt, hx711SleepOnTimed(0, CALLER_THREAD) == RETURN_DONE);	// Timed call
+		// Put hx711 to sleep mode if delay until the next read is long enough
+		if(dev->period) powerSetNext(POWER_HX711, dev->period->release + dev->period->period);
+		if(powerSleepWorth(POWER_HX711)) {
+			SCHED_WAIT_UNTIL(pt, 0, SCHED_EV_TIMED, hx711SleepOnTimed(dev, CALLER_THREAD) == RETURN_DONE);	// Timed call
+			powerSetState(POWER_HX711, POWER_SLEEP);
 		}
 
 	}
@@ -304,34 +326,59 @@ PT_THREAD(hx711Loop(struct pt *pt))
 	PT_END(pt);
 }
 
+PT_THREAD(hx711Loop(struct pt *pt))
+{
+	return hx711DeviceLoop(pt, &hx711Default);
+}
+
 /**
  * Returns 1 if data is valid (i.e. conversion not running)
  */
+uint8_t hx711DeviceDataValid(hx711Device *dev)
+{
+	return (dev->flags & HX711_DATA_VALID) ? 1 : 0;
+}
+
 uint8_t hx711DataValid()
 {
-	return (hx711Flags & HX711_DATA_VALID) ? 1 : 0;
+	return hx711DeviceDataValid(&hx711Default);
 }
 
 /**
  * Returns 1 if there is new data since last reset (value reset)
  */
+uint8_t hx711DeviceNewData(hx711Device *dev)
+{
+	return (dev->flags & HX711_NEW_DATA) ? 1 : 0;
+}
+
 uint8_t hx711NewData()
 {
-	return (hx711Flags & HX711_NEW_DATA) ? 1 : 0;
+	return hx711DeviceNewData(&hx711Default);
 }
 
 /**
  * Reset new data flag
  */
+void hx711DeviceResetNewData(hx711Device *dev)
+{
+	dev->flags &= ~HX711_NEW_DATA;
+}
+
 void hx711ResetNewData()
 {
-	hx711Flags &= ~HX711_NEW_DATA;
+	hx711DeviceResetNewData(&hx711Default);
 }
 
 /**
  * Get the latest conversion value
  */
+int32_t hx711DeviceGetLastValue(hx711Device *dev)
+{
+	return dev->value;
+}
+
 int32_t hx711GetLastValue()
 {
-	return hx711Value;
+	return hx711DeviceGetLastValue(&hx711Default);
 }
@@ -4,7 +4,7 @@
 // Library for communicating with HX711 weigh scale sensor IC
 
 #define HX711_TIME_INTERVAL			60000		// [ms] Timer interval, 1 minute
-#define HX711_SLEEP_THRESHOLD		10000		// Sleep if time between read is more than 10 seconds
+#define HX711_SLEEP_THRESHOLD		10000		// [ms] Sleep if time until next read is more than 10 seconds (power.h)
 
 #define HX711_SETTLING_TIME			400			// ms after reset etc, in 10 Hz mode 400 ms, in 80 Hz mode 50 ms
 #define HX711_CLOCK_TIME			10			// us, clock high and low times
@@ -21,43 +21,79 @@
 // Oversampling
 #define HX711_SAMPLES				16
 
+// One HX711 chip and its pins
+// All state of the driver is kept here, so several scales can be read
+// by declaring more devices, each with its own thread (hx711DeviceLoop).
+typedef struct _hx711Device {
+	timedContext timed;							// State of the timed functions, used by one at a time
+	uint32_t peripheral;						// GPIO peripheral of the pins
+	uint32_t port;
+	uint32_t clockPin;
+	uint32_t dataPin;
+	uint8_t channel;							// 25 = channel A gain 128, 26 = B gain 32, 27 = A gain 64
+	uint8_t flags;
+	uint8_t clocks;								// Bit counter of the timed read
+	uint8_t samples;							// Oversampling counter of the thread
+	int32_t value;								// Measured weight after oversampling
+	int32_t lastData;							// Latest conversion result
+	volatile uint32_t conversionData;			// Bits being read from interrupt
+	periodicTimer *period;
+} hx711Device;
+
+// Static initializer, pins are on the given GPIO port
+#define HX711_DEVICE_INIT(peripheral, port, clockPin, dataPin)	\
+	{ TIMED_CONTEXT_INIT, (peripheral), (port), (clockPin), (dataPin), 25, 0, 0, 0, 0, 0, 0, 0 }
+
+// The scale on PB0 (clock) and PB1 (data), used by the functions without device parameter
+extern hx711Device hx711Default;
+
 // Initialize weigh scale communication, i.e. set pins
 // Puts hx711 in sleep (reset) mode, so call hx711SleepOff when about to start
+void hx711DeviceSetup(hx711Device *dev);
 void hx711Setup(void);
 
+// Recover after the thread was restarted by the supervisor
+void hx711DeviceRecover(hx711Device *dev);
+void hx711Recover(void);
+
 // Set channel and gain; 0 = A gain 128, 1 = B gain 32, 2 or others = A gain 64
 // Returns previous mode
 // Change is sent to board when next conversion is read, after which
 // certain delay is needed before HX711 output is stable
-uint8_t hx711SetChannel(uint8_t ch);
+uint8_t hx711SetChannel(hx711Device *dev, uint8_t ch);
 
 // Returns 1 if data is ready (data pin low), 0 otherwise
-uint8_t hx711DataReady(void);
+uint8_t hx711DataReady(hx711Device *dev);
 
 // Read conversion value from selected channel
 // waits until data set is ready and blocks interrupts during read
 // Note that reading data while in sleep mode ends sleep mode and waits until data is ready
-int32_t hx711ReadData(void);
+int32_t hx711ReadData(hx711Device *dev);
 
 // Turn sleep mode on, does not block interrupts
-void hx711SleepOn(void);
+void hx711SleepOn(hx711Device *dev);
 
 // Turns off sleep mode, does not block interrupts
 // If block = 0, returns immediately, otherwise waits until outputs are stable
 // (400 ms or so)
-void hx711SleepOff(uint8_t block);
+void hx711SleepOff(hx711Device *dev, uint8_t block);
 
 
 // Main loop to read hx711 sensor data
+PT_THREAD(hx711DeviceLoop(struct pt *pt, hx711Device *dev));
 PT_THREAD(hx711Loop(struct pt *pt));
 
 // Returns 1 if data is valid (i.e. conversion not running)
+uint8_t hx711DeviceDataValid(hx711Device *dev);
 uint8_t hx711DataValid();
 // Returns 1 if new data since last reset (value reset)
+uint8_t hx711DeviceNewData(hx711Device *dev);
 uint8_t hx711NewData();
 // Reset new data flag
+void hx711DeviceResetNewData(hx711Device *dev);
 void hx711ResetNewData();
-// Return the latest conversion result in fixed point 12.4 (i.e. divide by 16.0 to get temp in Celsius)
+// Return the latest (oversampled) conversion result
+int32_t hx711DeviceGetLastValue(hx711Device *dev);
 int32_t hx711GetLastValue();
 
 
@@ -122,6 +122,8 @@
 
 #ifdef LC_INCLUDE
 #include LC_INCLUDE
+#elif defined(LC_ADDRLABELS)
+#include "lc-addrlabels.h"
 #else
 #include "lc-switch.h"
 #endif /* LC_INCLUDE */
@@ -27,12 +27,16 @@ typedef uint8_t bool;
 #include "pt.h"
 
 #include "common.h"
+#include "sched.h"
 #include "hx711.h"
 #include "mq3.h"
 #include "bubble.h"
 #include "ds18b20.h"
 #include "eeprom.h"
 #include "comm.h"
+#include "warm.h"
+#include "boot.h"
+#include "power.h"
 
 
 // Default configuration
@@ -46,23 +50,46 @@ eData latestData = {0};
 eData previousData = {0};
 uint16_t bubbleRawValue = 0;
 
-// Timer for storing to eeprom
-uint32_t *storeTimer = 0;
+// Timer for storing to eeprom, started by the boot thread
+threadTimer *storeTimer = 0;
 
-// Bitmask for indicating when new data was read from sensor
-#define NEW_DS						0x01
-#define NEW_BUBBLE					0x02
-#define NEW_HX711					0x04
-#define NEW_MQ3						0x08
+// Bitmask for indicating when new data was read from sensor (NEW_* in common.h)
 uint8_t newDataFlags = 0;
 
 volatile uint8_t ledStatus = 0;
+static uint8_t ledWritten = 0xFF;				// Value last written to the LED pins
 
 // Needed to get rid of Energia's default initializations
 void _init(void) {;}
 
 uint8_t mess[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
 
+// Copy new sensor data to latestData, called from TASK_COLLECT
+static inline void bubbleCollect(void)
+{
+	bubbleRawValue = bubbleGetLastValue();
+	latestData.bubble = bubbleGetIntegral();
+	latestData.bubbles = bubbleGetCount();
+	latestData.bubbleRate = bubbleGetRate();
+	latestData.bubbleLength = bubbleGetLength();
+	latestData.co2 = bubbleGetCo2Value();
+}
+
+static inline void hx711Collect(void)
+{
+	latestData.weight = hx711GetLastValue();
+}
+
+static inline void mq3Collect(void)
+{
+	latestData.ethanol = mq3GetValue();
+}
+
+static inline void dsCollect(void)
+{
+	latestData.temperature = dsGetLastValue();
+}
+
 void setDefaultConfig(void)
 {
 	systemConfig.bubbleLevel = 34;			// Bubble threshold 34 * 32 = 1100 ADC units
@@ -74,18 +101,27 @@ int main(void)
 {
 	int i;
 	int temp;
-	struct pt bubblePt, hx711Pt, mq3Pt, dsPt, commPt, rfCommPt;
+	uint32_t resetCause;
+	uint32_t storeNext;
+	const warmState *warm;
+
+	// Stack high-water mark, before anything else uses the stack
+	stackPaint();
 
 	// Set clock speed to 80 MHz
 	SysCtlClockSet(SYSCTL_SYSDIV_2_5 | SYSCTL_USE_PLL| SYSCTL_OSC_INT);
 
+	// Cycle counter for delays and profiling, 64-bit timebase for timestamps
+	InitCycleCounter();
+	InitTimebase();
+
 	// Led peripheral and pins
 	SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOF);
 	GPIOPinTypeGPIOOutput(GPIO_PORTF_BASE, GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3);
 
 	setupTimer(THREAD_TIMER_INTERVAL);
 
-	// Initialize timer
+	// Initialize exact timers for timed functions
 	InitTimedFunctions();
 	
 	// Initialize communications
@@ -93,73 +129,48 @@ int main(void)
 	rfCommSetup();
 
 
-	// Initialize eeprom
 	UARTSend("Init\r\n", 6);
-	eInit();
-	if(eIsOK()) {
-		// Try and read the configuration word...
-		eReadConfig(&systemConfig);
-		if(systemConfig.bubbleLevel == 255) {
-			UARTSend("Default conf\r\n", 14);
-			while(UARTBusy(UART0_BASE));
-			setDefaultConfig();
-		} else {
-			UARTSendInt(systemConfig.bubbleLevel);
-			while(UARTBusy(UART0_BASE));
-			UARTSend("\r\n", 2);
-			while(UARTBusy(UART0_BASE));
-			UARTSendInt(systemConfig.storeInterval);
-			while(UARTBusy(UART0_BASE));
-			UARTSend("\r\n", 2);
-			while(UARTBusy(UART0_BASE));
-
-			// Set the values to subsystems
-			bubbleSetThreshold(systemConfig.bubbleLevel);
-			if(systemConfig.flags & CONF_BUBBLE_AUTOLEVEL) bubbleSetThreshold(0);	// Auto level on
-		}
+
+	// Report if previous run was ended by the watchdog
+	resetCause = SysCtlResetCauseGet();
+	SysCtlResetCauseClear(resetCause);
+	if(resetCause & SYSCTL_CAUSE_WDOG0)
+		while(!UARTSend("Watchdog\r\n", 10));
+
+	// Continue from the state saved before reset if RAM kept it (warm.h),
+	// otherwise start with the defaults until the boot thread has read
+	// the configuration from EEPROM (boot.h)
+	warm = warmLoad(resetCause);
+	if(warm) {
+		systemConfig = warm->config;
+		latestData = warm->latest;
+		bubbleSetState(&warm->bubble);
 	} else {
-		UARTSend("Eeprom fail!\r\n", 14);
-		while(UARTBusy(UART0_BASE));
 		setDefaultConfig();
 	}
+	bootInit(warm);
 
 	// Verify struct sizes
 	if(sizeof(eData) != EEPROM_EDATA_SIZE) while(!UARTSend("eData size!\r\n", 13));
 	if(sizeof(eConfig) != EEPROM_ECONFIG_SIZE) while(!UARTSend("eConf size!\r\n", 13));
 
 	
-	// Initialize all sensors
-	hx711Setup();
-	mq3setup();
-	bubbleSetup();
-	dsSetup();
-
-	// Initialize timer for storing data to EEPROM
-	storeTimer = getFreeTimer();
-	if(storeTimer)
-		*storeTimer = systemConfig.storeInterval * 60000;		// Given in minutes
-
-	// Slow timer for all other stuff
-	//SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER1);
-	//TimerConfigure(TIMER1_BASE, TIMER_CFG_PERIODIC);
-	//TimerLoadSet64(TIMER1_BASE, (uint64_t)(SysCtlClockGet()/1000) * slowTimerStep);
-	//TimerIntRegister(TIMER1_BASE, TIMER_A, slowIntHandler);
-	//TimerIntEnable(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
-	//TimerEnable(TIMER1_BASE, TIMER_A);
-	//IntEnable(INT_TIMER1A);
+	// Initialize all sensors (see tasks.h)
+	TASK_TABLE(TASK_SETUP)
+
+	// Gate unused clocks in sleep, account power from now on
+	powerInit();
 
 	IntMasterEnable();
 
-	// Initializer protothreads
-	PT_INIT(&bubblePt);
-	PT_INIT(&hx711Pt);
-	PT_INIT(&mq3Pt);
-	PT_INIT(&dsPt);
-	PT_INIT(&commPt);
-	PT_INIT(&rfCommPt);
-	
-	// Update block number
-	latestData.n = eGetNextNum();
+	// Decide which timed function waits are spun, needs the timer interrupts
+	timedCalibrate();
+
+	// Initialize the protothreads of the task table
+	schedInit();
+
+	// Threads are supervised from now on
+	InitWatchdog();
 	
 	// Main loop
 	while(1)
@@ -167,56 +178,40 @@ int main(void)
 		// Handle common (thread) timers here so they don't need to be volatile
 		handleTimers();
 
-		// Schedule sensors
-		bubbleLoop(&bubblePt);
-		hx711Loop(&hx711Pt);
-		mq3Loop(&mq3Pt);
-		dsLoop(&dsPt);
-		commLoop(&commPt);
-		rfCommLoop(&rfCommPt);
+		// Run the threads that can make progress
+		schedRun();
 
-		// Blink LEDs if they are set
-		GPIOPinWrite(GPIO_PORTF_BASE, GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3, ledStatus);
+		// Blink LEDs if they are changed
+		if(ledStatus != ledWritten) {
+			ledWritten = ledStatus;
+			GPIOPinWrite(GPIO_PORTF_BASE, GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3, ledWritten);
+		}
 
 		// Check if EEPROM store timer was changed in communications loop
 		// If interval is shorter than current wait time, update it to the new interval
-		if(storeTimer && (*storeTimer) > (systemConfig.storeInterval * 60000)) *storeTimer = systemConfig.storeInterval * 60000;
-
-		// Check all sensors for new data
-		if(bubbleNewData()) {
-			bubbleRawValue = bubbleGetLastValue();
-			latestData.bubble = bubbleGetIntegral();
-			latestData.co2 = bubbleGetCo2Value();
-			newDataFlags |= NEW_BUBBLE;
-			bubbleResetNewData();
-		}
-		if(hx711NewData()) {
-			latestData.weight = hx711GetLastValue();
-			newDataFlags |= NEW_HX711;
-			hx711ResetNewData();
-		}
-		if(mq3NewData()) {
-			latestData.ethanol = mq3GetValue();
-			newDataFlags |= NEW_MQ3;
-			mq3ResetNewData();
-		}
-		if(dsNewData()) {
-			latestData.temperature = dsGetLastValue();
-			newDataFlags |= NEW_DS;
-			dsResetNewData();
-		}
-		
+		if(storeTimer && timerRemaining(storeTimer) > (systemConfig.storeInterval * 60000)) timerStart(storeTimer, systemConfig.storeInterval * 60000);
+
+		// Check all sensors for new data (see tasks.h)
+		TASK_TABLE(TASK_COLLECT)
+
 		// Read the latest bubble sensor level to config
 		/*
 		if(bubbleGetAutoLevelMode())
 			systemConfig.flags |= CONF_BUBBLE_AUTOLEVEL;
 		else
 			systemConfig.flags &= ~CONF_BUBBLE_AUTOLEVEL;*/
-		systemConfig.bubbleLevel = bubbleGetThreshold() >> 5;
+		if(systemConfig.bubbleLevel != bubbleGetThreshold() >> 5) {
+			systemConfig.bubbleLevel = bubbleGetThreshold() >> 5;
+			warmChanged();
+		}
 
 		// Store to eeprom if everything is fine!
-		if(storeTimer && !(*storeTimer)) {
-			*storeTimer = systemConfig.storeInterval * 60000;
+		if(storeTimer && timerExpired(storeTimer)) {
+			// Next store is one interval from the previous deadline, so late passes do not drift
+			// If a whole interval was missed, continue from now
+			storeNext = storeTimer->deadline + systemConfig.storeInterval * 60000;
+			if(TIME_AFTER_EQ(getTime(), storeNext)) storeNext = getTime() + systemConfig.storeInterval * 60000;
+			timerStartAt(storeTimer, storeNext);
 
 			if(!eWriteData(&latestData))
 				while(!UARTSend("S\r\n", 3));			// Storing data succesfull
@@ -225,7 +220,18 @@ int main(void)
 
 			ledStatus ^= LED_RED;						// Toggle red led
 			latestData.n = eGetNextNum();
+			warmChanged();								// Write position moved
 		}
+
+		// Keep the counters over a warm restart, once the write position is known
+		// Saved after the store, so the copy has the new write position
+		if(bootReady()) warmSave(&systemConfig, &latestData);
+
+		// Restart stuck threads, watchdog is fed only if none was stuck
+		if(schedSupervise()) watchdogFeed();
+
+		// Sleep until next tick or interrupt if all threads are waiting
+		schedIdle();
 	}
 
 	return 0;
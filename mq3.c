@@ -12,6 +12,9 @@ typedef uint8_t bool;
 #include "pt.h"
 
 #include "common.h"
+#include "sched.h"
+#include "resource.h"
+#include "filter.h"
 #include "mq3.h"
 
 // Port & pin mappings
@@ -25,10 +28,25 @@ const uint32_t mq3ADCSeq = 1;      // ADC sequence number
 
 uint8_t mq3Flags = 0;
 static unsigned long ulData[mq3ADCFifoDepth];
+static uint16_t mq3Samples[MQ3_SAMPLES];
+static filter mq3Filter;		// Average of the samples of one reading
+static resourceTicket mq3ADCTicket;		// Place in ADC0 queue
 uint16_t mq3Value = 0;
 
 // Timer
-uint32_t *mq3Timer;
+periodicTimer *mq3Period;
+
+// Configure ADC0 sequencer of the sensor
+static void _mq3ADCInit(void)
+{
+  ADCSequenceDisable(mq3ADC, mq3ADCSeq);
+  ADCSequenceConfigure(mq3ADC, mq3ADCSeq, ADC_TRIGGER_PROCESSOR, 1);	// Below the bubble sequence
+  ADCSequenceStepConfigure(mq3ADC, mq3ADCSeq, 0, ADC_CTL_CH0);
+  ADCSequenceStepConfigure(mq3ADC, mq3ADCSeq, 1, ADC_CTL_CH0);
+  ADCSequenceStepConfigure(mq3ADC, mq3ADCSeq, 2, ADC_CTL_CH0);
+  ADCSequenceStepConfigure(mq3ADC, mq3ADCSeq, 3, ADC_CTL_CH0 | ADC_CTL_IE | ADC_CTL_END);
+  ADCSequenceEnable(mq3ADC, mq3ADCSeq);
+}
 
 void mq3setup(void)
 {
@@ -49,26 +67,32 @@ void mq3setup(void)
     while(!SysCtlPeripheralReady(mq3ADCPeripheral));
   }
     
-  ADCSequenceDisable(mq3ADC, mq3ADCSeq);
-  ADCSequenceConfigure(mq3ADC, mq3ADCSeq, ADC_TRIGGER_PROCESSOR, 0);
-  ADCSequenceStepConfigure(mq3ADC, mq3ADCSeq, 0, ADC_CTL_CH0 | ADC_CTL_IE | ADC_CTL_END);
-  ADCSequenceEnable(mq3ADC, mq3ADCSeq);
+  _mq3ADCInit();
+  filterInit(&mq3Filter, 1, MQ3_SAMPLES_SHIFT, 0, 0);
   
-  mq3Timer = getFreeTimer();
+  mq3Period = getFreePeriodic(MQ3_TIME_INTERVAL);
+}
+
+// Thread was restarted by the supervisor, give up ADC0 and reconfigure
+void mq3Recover(void)
+{
+  resourceCancel(&resources[RESOURCE_ADC], &mq3ADCTicket);
+  _mq3ADCInit();
 }
 
 PT_THREAD(mq3Loop(struct pt *pt))
 {
+  uint8_t i;
+  int16_t value;
   PT_BEGIN(pt);
 
   while(1)
   {
-	if(mq3Timer) {
-		*mq3Timer = MQ3_TIME_INTERVAL;
-		PT_WAIT_WHILE(pt, *mq3Timer);
-	}
+	if(mq3Period)
+		SCHED_WAIT_PERIOD(pt, mq3Period);
     
-    // Do ADC conversion
+    // Do ADC conversion, sequence 1 is converted between the bubble samples
+    RESOURCE_ACQUIRE(pt, &resources[RESOURCE_ADC], &mq3ADCTicket);
     ADCIntClear(mq3ADC, mq3ADCSeq);
     ADCProcessorTrigger(mq3ADC, mq3ADCSeq);
 
@@ -76,8 +100,12 @@ PT_THREAD(mq3Loop(struct pt *pt))
     PT_WAIT_UNTIL(pt, ADCIntStatus(mq3ADC, mq3ADCSeq, 0));
   
     ADCSequenceDataGet(mq3ADC, mq3ADCSeq, ulData);
-    mq3Value = (uint16_t)ulData[0];
-    mq3Flags |= (MQ3_DATA_VALID | MQ3_NEW_DATA);
+    RESOURCE_RELEASE(&resources[RESOURCE_ADC], &mq3ADCTicket);
+    for(i = 0; i < MQ3_SAMPLES; i++) mq3Samples[i] = (uint16_t)ulData[i];
+    if(filterBlock(&mq3Filter, mq3Samples, MQ3_SAMPLES, &value)) {
+      mq3Value = (uint16_t)value;
+      mq3Flags |= (MQ3_DATA_VALID | MQ3_NEW_DATA);
+    }
   }  
 
   PT_END(pt);
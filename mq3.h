@@ -5,7 +5,9 @@
 
 #define MQ3_TIME_INTERVAL		10000			// Read every 10 seconds
 
-#define mq3ADCFifoDepth			8				// Sequence 1 has fifo of 8 samples
+#define mq3ADCFifoDepth			8				// Sequence 1 has fifo of 4 samples
+#define MQ3_SAMPLES_SHIFT		2				// Average of 4 samples per reading (filter.h)
+#define MQ3_SAMPLES				(1 << MQ3_SAMPLES_SHIFT)
 
 #define MQ3_DATA_VALID			0x01
 #define MQ3_NEW_DATA			0x02
@@ -13,6 +15,9 @@
 // Initialize all pins and ports
 void mq3setup(void);
 
+// Recover after the thread was restarted by the supervisor
+void mq3Recover(void);
+
 // Read one sample from MQ-3
 // Blocks until conversion is done
 PT_THREAD(mq3Loop(struct pt *pt));
@@ -39,13 +39,17 @@ typedef uint8_t bool;
 #include "inc/hw_types.h"
 #include "inc/hw_memmap.h"
 #include "inc/hw_ssi.h"
+#include "inc/hw_gpio.h"
 
 #include "driverlib/pin_map.h"
 #include "driverlib/sysctl.h"
 #include "driverlib/gpio.h"
 #include "driverlib/ssi.h"
 
+#include "pt.h"
+
 #include "common.h"
+#include "pin.h"
 #include "nrf24l01.h"
 
 // PA2	  = NRF24L01 SPI CLK
@@ -58,10 +62,11 @@ typedef uint8_t bool;
 // #define RF24DEBUG
 #undef RF24DEBUG
 
-const uint32_t RF24_CE_PORT = GPIO_PORTB_BASE;
-const uint32_t RF24_CSN_PORT = GPIO_PORTB_BASE;
-const uint32_t RF24_CE_PIN = GPIO_PIN_3;
-const uint32_t RF24_CSN_PIN = GPIO_PIN_4;
+// Defines, so that pin writes are resolved at compile time
+#define RF24_CE_PORT	GPIO_PORTB_BASE
+#define RF24_CSN_PORT	GPIO_PORTB_BASE
+#define RF24_CE_PIN		GPIO_PIN_3
+#define RF24_CSN_PIN	GPIO_PIN_4
 
 static const uint8_t rf24_max_payload_size = 32;		// Maximum payload length of the chip
 uint8_t payload_size = 32;						// Default
@@ -113,8 +118,8 @@ void rf24Setup(void)
 
 	// TODO: Change to 2 lines to have both ports
 	GPIOPinTypeGPIOOutput(GPIO_PORTB_BASE, RF24_CSN_PIN | RF24_CE_PIN);		// CE & CSN
-	GPIOPinWrite(RF24_CE_PORT, RF24_CE_PIN, 0);								// CE low
-	GPIOPinWrite(RF24_CSN_PORT, RF24_CSN_PIN, RF24_CSN_PIN);				// CSN Hi (not active)
+	pinWrite(RF24_CE_PORT, RF24_CE_PIN, 0);									// CE low
+	pinWrite(RF24_CSN_PORT, RF24_CSN_PIN, RF24_CSN_PIN);					// CSN Hi (not active)
 
 	SSIEnable(SSI0_BASE);													// Enable SSI0
 }
@@ -128,7 +133,7 @@ void rf24Setup(void)
  */
 inline void rf24ce(uint8_t level)
 {
-	GPIOPinWrite(RF24_CE_PORT, RF24_CE_PIN, level ? RF24_CE_PIN : 0);
+	pinWrite(RF24_CE_PORT, RF24_CE_PIN, level ? RF24_CE_PIN : 0);
 }
 
 /**
@@ -140,7 +145,7 @@ inline void rf24ce(uint8_t level)
  */
 inline void rf24csn(uint8_t level)
 {
-	GPIOPinWrite(RF24_CSN_PORT, RF24_CSN_PIN, level ? RF24_CSN_PIN : 0);
+	pinWrite(RF24_CSN_PORT, RF24_CSN_PIN, level ? RF24_CSN_PIN : 0);
 }
 
 /**
@@ -460,13 +465,12 @@ void rf24PowerDown(void)
 
 /**
  * Power up the radio part of the module
- *
+ * Does not wait, nothing may be sent before RF24_POWERUP_TIME has passed
  */
 void rf24PowerUp(void)
 {
 	// Transmitter power-up
 	rf24WriteRegister(CONFIG, (rf24ReadRegister(CONFIG) | (1 << PWR_UP)));
-	delayMicrosec(150);
 }
 
 /**
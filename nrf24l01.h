@@ -141,6 +141,8 @@
 #define RF24_TX_OK				1
 #define RF24_TX_FAIL			2
 
+#define RF24_POWERUP_TIME		2			// [ms] From power down to standby, 1.5 ms with crystal
+
 
 // Flags
 #define RF24_FLAG_DYNAMIC		0x01		// Dynamic payloads enabled
@@ -152,6 +154,7 @@
 // Functions
 void rf24Setup(void);
 void rf24Init(void);
+void rf24PowerDown(void);
 void rf24PowerUp(void);
 uint8_t rf24ReadStatus(void);
 void rf24OpenWritingPipe(uint64_t value);
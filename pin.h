@@ -0,0 +1,30 @@
+#ifndef __PIN_H__
+#define __PIN_H__
+
+// Direct GPIO pin access for bit-banged drivers
+//
+// GPIO DATA register is aliased over 256 addresses, address bits 9:2 mask
+// the pins that are affected. A masked read or write is therefore a single
+// load or store, without the function call and checks of GPIOPinWrite()
+// and GPIOPinRead(). When port and pins are constants the address is
+// resolved at compile time, otherwise it costs one shift and add.
+//
+// Needs inc/hw_gpio.h. Defining PIN_DRIVERLIB maps these back to driverlib.
+
+#define PIN_DATA(port, pins)	(*((volatile uint32_t *)((port) + GPIO_O_DATA + ((uint32_t)(pins) << 2))))
+
+#ifndef PIN_DRIVERLIB
+
+// Write value to the masked pins of port, other pins are not changed
+#define pinWrite(port, pins, value)		(PIN_DATA((port), (pins)) = (uint8_t)(value))
+// Read masked pins of port, other bits are zero
+#define pinRead(port, pins)				((uint8_t)PIN_DATA((port), (pins)))
+
+#else
+
+#define pinWrite(port, pins, value)		GPIOPinWrite((port), (pins), (value))
+#define pinRead(port, pins)				GPIOPinRead((port), (pins))
+
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Power state manager of the brewing monitor
+ *
+ * Keeps track of the state of the CPU, the hx711, the radio and the ADC,
+ * when they are needed next and how much time they spend in every state.
+ * See power.h.
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "inc/tm4c123gh6pm.h"
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+
+#include "driverlib/sysctl.h"
+
+#include "pt.h"
+
+#include "common.h"
+#include "hx711.h"
+#include "power.h"
+
+
+// Typical currents [uA] in POWER_SLEEP, POWER_IDLE and POWER_ACTIVE
+static const uint32_t powerCurrent[POWER_SUBSYSTEMS][POWER_STATES] = {
+	{ 16000, 45000, 45000 },		// TM4C123 at 80 MHz: sleep with gated clocks, run
+	{ 1, 1500, 1500 },				// HX711: power down, normal operation
+	{ 1, 26, 11300 },				// nRF24L01+: power down, standby-I, TX at 0 dBm
+	{ 0, 0, 1500 }					// ADC0: unused, sampling the bubble sensor
+};
+
+// Shortest time between uses [ms] that is worth sleeping for
+static const uint32_t powerBreakEven[POWER_SUBSYSTEMS] = {
+	0, HX711_SLEEP_THRESHOLD, POWER_RADIO_BREAKEVEN, 0 };
+
+// Peripherals that must keep running while the CPU sleeps, others are gated:
+// GPIO (pin states), exact timers, timebase, UART receive, the watchdog
+// and the bubble sample chain (TIMER1, ADC0, uDMA)
+static const uint32_t powerSleepPeripherals[] = {
+	SYSCTL_PERIPH_GPIOA, SYSCTL_PERIPH_GPIOB, SYSCTL_PERIPH_GPIOD, SYSCTL_PERIPH_GPIOE,
+	SYSCTL_PERIPH_GPIOF,
+	SYSCTL_PERIPH_TIMER0, SYSCTL_PERIPH_TIMER1, SYSCTL_PERIPH_TIMER2, SYSCTL_PERIPH_TIMER3,
+	SYSCTL_PERIPH_TIMER4, SYSCTL_PERIPH_TIMER5, SYSCTL_PERIPH_WTIMER0, SYSCTL_PERIPH_UART0,
+	SYSCTL_PERIPH_WDOG0, SYSCTL_PERIPH_ADC0, SYSCTL_PERIPH_UDMA };
+
+static uint8_t powerState[POWER_SUBSYSTEMS] = { POWER_ACTIVE, POWER_SLEEP, POWER_IDLE, POWER_ACTIVE };
+static uint32_t powerNext[POWER_SUBSYSTEMS];			// Next use [ms]
+static uint64_t powerSince[POWER_SUBSYSTEMS];			// Cycles when the state was entered
+static uint64_t powerTime[POWER_SUBSYSTEMS][POWER_STATES];	// Cycles spent in each state
+
+
+void powerInit(void)
+{
+	uint8_t i;
+	uint64_t now = getCycles();
+
+	for(i=0; i < sizeof(powerSleepPeripherals) / sizeof(powerSleepPeripherals[0]); i++)
+		SysCtlPeripheralSleepEnable(powerSleepPeripherals[i]);
+	SysCtlPeripheralClockGating(1);
+
+	for(i=0; i < POWER_SUBSYSTEMS; i++)
+		powerSince[i] = now;
+}
+
+/**
+ * Account the time of the previous state and enter the new one
+ * Called from threads and the scheduler, not from interrupts
+ */
+void powerSetState(uint8_t sub, uint8_t state)
+{
+	uint64_t now;
+
+	if(sub >= POWER_SUBSYSTEMS || state >= POWER_STATES || state == powerState[sub]) return;
+
+	now = getCycles();
+	powerTime[sub][powerState[sub]] += now - powerSince[sub];
+	powerSince[sub] = now;
+	powerState[sub] = state;
+}
+
+uint8_t powerGetState(uint8_t sub)
+{
+	if(sub >= POWER_SUBSYSTEMS) return POWER_ACTIVE;
+	return powerState[sub];
+}
+
+void powerSetNext(uint8_t sub, uint32_t time)
+{
+	if(sub >= POWER_SUBSYSTEMS) return;
+	powerNext[sub] = time;
+}
+
+uint8_t powerSleepWorth(uint8_t sub)
+{
+	if(sub >= POWER_SUBSYSTEMS) return 0;
+	return TIME_AFTER_EQ(powerNext[sub], getTime() + powerBreakEven[sub]) ? 1 : 0;
+}
+
+// Cycles spent in a state, including the ongoing one
+static uint64_t _powerCycles(uint8_t sub, uint8_t state)
+{
+	uint64_t cycles = powerTime[sub][state];
+	if(powerState[sub] == state) cycles += getCycles() - powerSince[sub];
+	return cycles;
+}
+
+uint32_t powerGetTime(uint8_t sub, uint8_t state)
+{
+	if(sub >= POWER_SUBSYSTEMS || state >= POWER_STATES) return 0;
+	return (uint32_t)(_powerCycles(sub, state) / (CLOCKS_IN_US * 1000));
+}
+
+uint32_t powerGetCharge(uint8_t sub)
+{
+	uint8_t state;
+	uint64_t charge = 0;						// [uA ms]
+
+	if(sub >= POWER_SUBSYSTEMS) return 0;
+	for(state=0; state < POWER_STATES; state++)
+		charge += (_powerCycles(sub, state) / (CLOCKS_IN_US * 1000)) * powerCurrent[sub][state];
+
+	return (uint32_t)(charge / 3600000);		// 1 uAh = 3600000 uA ms
+}
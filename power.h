@@ -0,0 +1,52 @@
+#ifndef __POWER_H__
+#define __POWER_H__
+
+// Power states of the subsystems
+//
+// Every subsystem tells the manager when it changes state and when it is
+// needed next. A driver puts its device to sleep between uses only when the
+// next use is further away than the break-even time of the device, i.e. the
+// wake-up (e.g. hx711 settling) costs less than sleeping saves. Time spent
+// in every state is accounted and the charge drawn is estimated from typical
+// datasheet currents, so the effect on a battery can be followed.
+//
+// The CPU sleeps (WFI) when no thread is runnable, with the clocks of the
+// peripherals that are not needed to wake it gated (powerInit). Deep sleep
+// is not used, since it would stop the PLL that the system tick, the exact
+// timers and the timebase run on.
+
+#define POWER_CPU					0
+#define POWER_HX711					1
+#define POWER_RADIO					2
+#define POWER_ADC					3				// ADC0, always active while sampling the bubble sensor
+#define POWER_SUBSYSTEMS			4
+
+#define POWER_SLEEP					0				// Lowest power state (CPU: WFI)
+#define POWER_IDLE					1				// Powered but not working (radio standby)
+#define POWER_ACTIVE				2
+#define POWER_STATES				3
+
+#define POWER_RADIO_BREAKEVEN		10				// [ms] Power the radio down if not needed in this time
+
+// Set up sleep mode clock gating and start the accounting,
+// called after the peripherals have been initialized
+void powerInit(void);
+
+// Subsystem changed state, the driver itself powers the device up or down
+void powerSetState(uint8_t sub, uint8_t state);
+
+uint8_t powerGetState(uint8_t sub);
+
+// Subsystem is needed next at system time [ms]
+void powerSetNext(uint8_t sub, uint32_t time);
+
+// Returns 1 if the next use is far enough for the subsystem to sleep until then
+uint8_t powerSleepWorth(uint8_t sub);
+
+// Time spent in a state since powerInit() [ms]
+uint32_t powerGetTime(uint8_t sub, uint8_t state);
+
+// Estimated charge drawn since powerInit() [uAh]
+uint32_t powerGetCharge(uint8_t sub);
+
+#endif
@@ -0,0 +1,273 @@
+/**
+ * Run time profiling of protothreads, timed functions and interrupts
+ *
+ * Counts invocations, invocations without progress and cycles used
+ * per thread, and the share of time the core spends sleeping.
+ * Interrupt latencies and durations are collected to log-scale histograms.
+ * Measurements are taken with the DWT cycle counter, except for the sleep
+ * and elapsed time, which use the 64-bit timebase since the DWT counter
+ * stops while the core sleeps.
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "inc/tm4c123gh6pm.h"
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+
+#include "inc/hw_gpio.h"
+
+#include "driverlib/interrupt.h"
+#include "driverlib/gpio.h"
+
+#include "pt.h"
+
+#include "common.h"
+#include "sched.h"
+#include "profile.h"
+#include "pin.h"
+
+#ifdef PROFILE
+
+static profileCounter profileThreads[PROFILE_THREADS];
+static profileCounter profileTimedFunc[PROFILE_TIMED];
+
+static uint64_t profileElapsed = 0;					// Cycles since reset
+static uint64_t profileSlept = 0;					// Cycles spent sleeping
+static uint64_t profileLastPass = 0;
+static profileWaitError profileWaits[2];			// Exact timer and spun waits
+
+
+static void _profileAdd(profileCounter *counter, uint32_t cycles)
+{
+	counter->runs++;
+	counter->cycles += cycles;
+	if(!counter->minCycles || cycles < counter->minCycles) counter->minCycles = cycles;
+	if(cycles > counter->maxCycles) counter->maxCycles = cycles;
+}
+
+/**
+ * Thread was run
+ * Progress is zero if the thread only checked its wait condition,
+ * see _schedCall()
+ */
+void profileThread(uint8_t n, uint32_t cycles, uint8_t progress)
+{
+	if(n >= PROFILE_THREADS) return;
+	_profileAdd(&profileThreads[n], cycles);
+	if(!progress) profileThreads[n].idleRuns++;
+}
+
+/**
+ * Timed function continued from exact timer interrupt
+ * Functions are told apart by their address
+ */
+void profileTimed(const void *func, uint32_t cycles)
+{
+	uint8_t i;
+
+	if(!func) return;
+	for(i=0; i < PROFILE_TIMED; i++) {
+		if(profileTimedFunc[i].id == func) break;
+		if(!profileTimedFunc[i].id) {
+			profileTimedFunc[i].id = func;				// First time seen
+			break;
+		}
+	}
+	if(i < PROFILE_TIMED)
+		_profileAdd(&profileTimedFunc[i], cycles);
+}
+
+/**
+ * Timed function wait ended
+ * Called from the exact timer interrupt when the wait used the timer
+ */
+void profileWait(uint8_t spin, uint32_t requested, uint32_t actual)
+{
+	profileWaitError *w = &profileWaits[spin ? 1 : 0];
+	uint32_t error = (actual > requested) ? actual - requested : 0;
+
+	w->waits++;
+	w->errorTotal += error;
+	if(error > w->errorMax) w->errorMax = error;
+}
+
+void profileIdle(uint64_t cycles)
+{
+	profileSlept += cycles;
+}
+
+/**
+ * Accumulate elapsed time, called on every scheduler pass
+ */
+void profilePass(void)
+{
+	uint64_t now = getCycles();
+	profileElapsed += now - profileLastPass;
+	profileLastPass = now;
+}
+
+/**
+ * Interrupts are disabled, the exact timer interrupts update the timed
+ * function slots and the wait errors
+ */
+void profileReset(void)
+{
+	uint8_t i;
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	for(i=0; i < PROFILE_THREADS; i++) {
+		profileThreads[i].runs = 0;
+		profileThreads[i].idleRuns = 0;
+		profileThreads[i].cycles = 0;
+		profileThreads[i].minCycles = 0;
+		profileThreads[i].maxCycles = 0;
+	}
+	for(i=0; i < PROFILE_TIMED; i++) {
+		profileTimedFunc[i].id = 0;
+		profileTimedFunc[i].runs = 0;
+		profileTimedFunc[i].idleRuns = 0;
+		profileTimedFunc[i].cycles = 0;
+		profileTimedFunc[i].minCycles = 0;
+		profileTimedFunc[i].maxCycles = 0;
+	}
+	for(i=0; i < 2; i++) {
+		profileWaits[i].waits = 0;
+		profileWaits[i].errorTotal = 0;
+		profileWaits[i].errorMax = 0;
+	}
+	profileElapsed = 0;
+	profileSlept = 0;
+	profileLastPass = getCycles();
+	if(!bInt) IntMasterEnable();
+}
+
+profileCounter *profileGetThread(uint8_t n)
+{
+	if(n >= PROFILE_THREADS || !profileThreads[n].runs) return 0;
+	return &profileThreads[n];
+}
+
+profileCounter *profileGetTimed(uint8_t n)
+{
+	if(n >= PROFILE_TIMED || !profileTimedFunc[n].id) return 0;
+	return &profileTimedFunc[n];
+}
+
+profileWaitError *profileGetWait(uint8_t spin)
+{
+	return &profileWaits[spin ? 1 : 0];
+}
+
+uint8_t profileGetIdlePercent(void)
+{
+	if(!profileElapsed) return 0;
+	return (uint8_t)((profileSlept * 100) / profileElapsed);
+}
+
+// Repeat the access 8 times without loop overhead
+#define PROFILE_PIN_8(x)	x; x; x; x; x; x; x; x
+
+/**
+ * Measure what a pin write and read costs through driverlib and pin.h
+ * An empty pin mask is used so the port is not changed, but the access
+ * is otherwise identical. The cost of reading the cycle counter is
+ * subtracted. An edge of a bit-banged clock is one write, a 1-Wire slot
+ * two writes and a read.
+ */
+void profilePins(uint32_t port, profilePinCost *cost)
+{
+	uint32_t start, overhead;
+	volatile uint8_t sink;
+	bool bInt;
+
+	bInt = IntMasterDisable();
+
+	start = DWT_CYCCNT_R;
+	overhead = DWT_CYCCNT_R - start;
+
+	start = DWT_CYCCNT_R;
+	PROFILE_PIN_8(GPIOPinWrite(port, 0, 0));
+	cost->libWrite = DWT_CYCCNT_R - start - overhead;
+
+	start = DWT_CYCCNT_R;
+	PROFILE_PIN_8(pinWrite(port, 0, 0));
+	cost->pinWrite = DWT_CYCCNT_R - start - overhead;
+
+	start = DWT_CYCCNT_R;
+	PROFILE_PIN_8(sink = GPIOPinRead(port, 0));
+	cost->libRead = DWT_CYCCNT_R - start - overhead;
+
+	start = DWT_CYCCNT_R;
+	PROFILE_PIN_8(sink = pinRead(port, 0));
+	cost->pinRead = DWT_CYCCNT_R - start - overhead;
+
+	if(!bInt) IntMasterEnable();
+	(void)sink;
+}
+
+#endif
+
+
+#ifdef PROFILE_ISR
+
+static profileIsrHistogram profileIsrs[PROFILE_ISRS];
+
+
+// Histogram bin of a value, i.e. position of the highest set bit (CLZ instruction)
+static inline uint8_t _profileBin(uint32_t value)
+{
+	uint8_t bin;
+
+	if(!value) return 0;
+	bin = 31 - __builtin_clz(value);
+	return (bin < PROFILE_ISR_BINS) ? bin : PROFILE_ISR_BINS - 1;
+}
+
+/**
+ * Interrupt handler returned
+ * Called from the interrupt itself, so it must be kept short
+ */
+void profileIsr(uint8_t n, uint32_t latency, uint32_t duration)
+{
+	profileIsrHistogram *h;
+
+	if(n >= PROFILE_ISRS) return;
+	h = &profileIsrs[n];
+
+	if(latency != PROFILE_ISR_NO_LATENCY) {
+		h->latency[_profileBin(latency)]++;
+		if(latency > h->maxLatency) h->maxLatency = latency;
+	}
+	h->duration[_profileBin(duration)]++;
+	if(duration > h->maxDuration) h->maxDuration = duration;
+}
+
+void profileIsrReset(void)
+{
+	uint8_t i, j;
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	for(i=0; i < PROFILE_ISRS; i++) {
+		for(j=0; j < PROFILE_ISR_BINS; j++) {
+			profileIsrs[i].latency[j] = 0;
+			profileIsrs[i].duration[j] = 0;
+		}
+		profileIsrs[i].maxLatency = 0;
+		profileIsrs[i].maxDuration = 0;
+	}
+	if(!bInt) IntMasterEnable();
+}
+
+profileIsrHistogram *profileGetIsr(uint8_t n)
+{
+	if(n >= PROFILE_ISRS) return 0;
+	return &profileIsrs[n];
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+// Run time profiling of threads, timed functions and interrupts
+//
+// Enabled by defining PROFILE in common.h. Every thread invocation from the
+// scheduler and every timed function callback from the exact timer
+// interrupts is measured with the DWT cycle counter. Sleep, elapsed time,
+// TIMER_WAIT durations and exact timer latencies span sleeps, so they use
+// the timebase (getCycles) since the DWT counter stops in WFI. Without
+// PROFILE the macros below compile to nothing.
+//
+// PROFILE_ISR separately enables latency and duration histograms of the
+// system tick, exact timer and UART interrupts.
+
+#define PROFILE_THREADS				SCHED_TASKS		// One counter per scheduled thread
+#define PROFILE_TIMED				8				// Timed functions that can be told apart
+
+// Run time counters of one thread or timed function
+typedef struct _profileCounter {
+	const void *id;							// Timed function, 0 for threads
+	uint32_t runs;							// Number of invocations
+	uint32_t idleRuns;						// Invocations that returned without progress
+	uint64_t cycles;						// Total cycles used
+	uint32_t minCycles;
+	uint32_t maxCycles;
+} profileCounter;
+
+#ifdef PROFILE
+
+// Take start time, must be used before the matching *_END macro in same block
+#define PROFILE_START()					uint32_t _profileStart = DWT_CYCCNT_R
+// Thread n returned, progress is nonzero if it passed a wait or its continuation changed
+#define PROFILE_THREAD_END(n, progress)	profileThread((n), DWT_CYCCNT_R - _profileStart, (progress))
+// Timed function callback returned to interrupt handler
+#define PROFILE_TIMED_END(func)			profileTimed((const void *)(func), DWT_CYCCNT_R - _profileStart)
+// Take start time of a sleep, the DWT counter stops in WFI so the timebase is used
+#define PROFILE_IDLE_START()			uint64_t _profileIdleStart = getCycles()
+// Core woke up from sleep
+#define PROFILE_IDLE_END()				profileIdle(getCycles() - _profileIdleStart)
+// New scheduler pass, keeps track of elapsed time
+#define PROFILE_PASS()					profilePass()
+
+#else
+
+#define PROFILE_START()
+#define PROFILE_THREAD_END(n, progress)	((void)(progress))
+#define PROFILE_TIMED_END(func)
+#define PROFILE_IDLE_START()
+#define PROFILE_IDLE_END()
+#define PROFILE_PASS()
+
+#endif
+
+// Interrupts with histograms
+#define PROFILE_ISR_TICK			0				// timerIntHandler (SysTick)
+#define PROFILE_ISR_TIMED			1				// timedFunctionsIntHandler* (all exact timers)
+#define PROFILE_ISR_UART			2				// UARTIntHandler
+#define PROFILE_ISR_ADC				3				// bubbleADCIntHandler (uDMA block done)
+#define PROFILE_ISR_CO2				4				// bubbleCo2IntHandler (Hall switch edge)
+#define PROFILE_ISRS				5
+
+// Bin n counts values of 2^n ... 2^(n+1)-1 cycles, bin 0 also counts 0
+// and the last bin everything above, i.e. >= 410 us
+#define PROFILE_ISR_BINS			16
+#define PROFILE_ISR_NO_LATENCY		0xFFFFFFFF		// Event time is not known, only duration is binned
+
+// Log-scale histograms of one interrupt
+typedef struct _profileIsrHistogram {
+	uint32_t latency[PROFILE_ISR_BINS];		// From hardware event to handler entry [cycles]
+	uint32_t duration[PROFILE_ISR_BINS];	// From handler entry to exit [cycles]
+	uint32_t maxLatency;
+	uint32_t maxDuration;
+} profileIsrHistogram;
+
+#ifdef PROFILE_ISR
+
+// Take entry time, latency is the number of cycles since the hardware event
+#define PROFILE_ISR_ENTER(latency)		uint32_t _isrStart = DWT_CYCCNT_R; uint32_t _isrLatency = (latency)
+// Handler of interrupt n returns
+#define PROFILE_ISR_EXIT(n)				profileIsr((n), _isrLatency, DWT_CYCCNT_R - _isrStart)
+
+#else
+
+#define PROFILE_ISR_ENTER(latency)
+#define PROFILE_ISR_EXIT(n)
+
+#endif
+
+// Add a measurement
+void profileThread(uint8_t n, uint32_t cycles, uint8_t progress);
+void profileTimed(const void *func, uint32_t cycles);
+void profileIdle(uint64_t cycles);
+void profilePass(void);
+void profileIsr(uint8_t n, uint32_t latency, uint32_t duration);
+
+// Clear all counters
+void profileReset(void);
+void profileIsrReset(void);
+
+// Get counters, returns 0 if n is out of range or slot is unused
+profileCounter *profileGetThread(uint8_t n);
+profileCounter *profileGetTimed(uint8_t n);
+
+// Get percentage of time spent sleeping since last reset
+uint8_t profileGetIdlePercent(void);
+
+// Accuracy of TIMER_WAIT, separately for timer (0) and spun (1) waits
+typedef struct _profileWaitError {
+	uint32_t waits;
+	uint32_t errorTotal;					// Sum of waits longer than requested [cycles]
+	uint32_t errorMax;
+} profileWaitError;
+
+// Wait of requested cycles took actual cycles
+void profileWait(uint8_t spin, uint32_t requested, uint32_t actual);
+
+// Get wait accuracy, 0 = exact timer and 1 = spun waits
+profileWaitError *profileGetWait(uint8_t spin);
+
+// Cost of 8 back-to-back pin accesses [cycles], driverlib vs pin.h
+typedef struct _profilePinCost {
+	uint32_t libWrite;
+	uint32_t pinWrite;
+	uint32_t libRead;
+	uint32_t pinRead;
+} profilePinCost;
+
+// Measure pin access costs on port, no pins are changed
+void profilePins(uint32_t port, profilePinCost *cost);
+
+// Get histograms of interrupt n, returns 0 if n is out of range
+profileIsrHistogram *profileGetIsr(uint8_t n);
+
+#endif
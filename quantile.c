@@ -0,0 +1,41 @@
+/**
+ * Streaming quantile estimator, see quantile.h
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "quantile.h"
+
+
+void quantileInit(quantile *q, uint8_t percent, uint16_t step, uint16_t initial)
+{
+	if(percent < 1) percent = 1;
+	if(percent > 99) percent = 99;
+
+	// In balance when percent % of the samples are below the estimate
+	q->up = (uint16_t)(((uint32_t)step * percent) / 100);
+	q->down = (uint16_t)(((uint32_t)step * (100 - percent)) / 100);
+	if(!q->up) q->up = 1;
+	if(!q->down) q->down = 1;
+
+	quantileSet(q, initial);
+}
+
+/**
+ * Rounded to the nearest integer, clamped to the 16-bit range
+ */
+uint16_t quantileGet(const quantile *q)
+{
+	int32_t value = (q->estimate + 128) >> 8;
+	if(value < 0) return 0;
+	if(value > 0xFFFF) return 0xFFFF;
+	return (uint16_t)value;
+}
+
+void quantileSet(quantile *q, uint16_t value)
+{
+	q->estimate = (int32_t)value << 8;
+}
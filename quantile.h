@@ -0,0 +1,37 @@
+#ifndef __QUANTILE_H__
+#define __QUANTILE_H__
+
+// Streaming quantile estimator
+//
+// Tracks the p-th percentile of a signal with one value of memory: the
+// estimate moves up by p * step when a sample is above it and down by
+// (100 - p) * step when a sample is below it, so it settles where p % of
+// the samples are below. Unlike min/max tracking a single spike moves the
+// estimate only by one step, and after a step change in the signal the
+// estimate follows at a steady rate instead of waiting for a slow relax.
+// Deterministic and integer only, the estimate is kept in 1/256 units.
+
+// Estimator state
+typedef struct _quantile {
+	int32_t estimate;						// [1/256]
+	uint16_t up;							// Step when sample is above the estimate [1/256]
+	uint16_t down;							// Step when sample is below the estimate [1/256]
+} quantile;
+
+// Track percentile (1...99), step is the total of up and down steps [1/256]
+void quantileInit(quantile *q, uint8_t percent, uint16_t step, uint16_t initial);
+
+// Move the estimate towards the sample
+static inline void quantileUpdate(quantile *q, uint16_t sample)
+{
+	int32_t x = (int32_t)sample << 8;
+	if(x > q->estimate) q->estimate += q->up;
+	else if(x < q->estimate) q->estimate -= q->down;
+}
+
+uint16_t quantileGet(const quantile *q);
+
+// Continue from a known value, e.g. after a warm restart
+void quantileSet(quantile *q, uint16_t value);
+
+#endif
@@ -0,0 +1,152 @@
+/**
+ * First-in first-out arbitration of shared hardware resources
+ *
+ * Threads take a ticket when they start waiting and the resource is
+ * granted strictly in ticket order, so a thread cannot be starved by
+ * threads that happen to be polled earlier. Queued tickets form a linked
+ * list from the head, the ticket being served, to the tail.
+ *
+ * Uses protothreads (by Adam Dunkels, http://dunkels.com/adam/pt/)
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "inc/tm4c123gh6pm.h"
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+
+#include "driverlib/interrupt.h"
+
+#include "pt.h"
+
+#include "common.h"
+#include "sched.h"
+#include "resource.h"
+
+
+resource resources[RESOURCES] = {
+	RESOURCE_INIT(EXACT_TIMERS),			// RESOURCE_TIMER
+	RESOURCE_INIT(1),						// RESOURCE_ADC
+	RESOURCE_INIT(1)						// RESOURCE_SSI
+};
+
+
+/**
+ * Unlink ticket t from the queue, nothing is done if it is not queued
+ * Interrupts must be disabled
+ */
+static void _resourceUnlink(resource *res, resourceTicket *t)
+{
+	resourceTicket **pos = &res->head;
+	resourceTicket *prev = 0;
+
+	while(*pos && *pos != t) {
+		prev = *pos;
+		pos = &(*pos)->next;
+	}
+	if(!*pos) return;
+
+	*pos = t->next;
+	if(res->tail == t) res->tail = prev;
+	t->next = 0;
+	res->waiting--;
+}
+
+/**
+ * Enter the end of the queue
+ * A ticket that is still queued, e.g. after its thread was restarted
+ * without cancelling, leaves its old place first
+ */
+void resourceEnqueue(resource *res, resourceTicket *t)
+{
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	if(t->state == RESOURCE_TICKET_QUEUED) _resourceUnlink(res, t);
+	t->next = 0;
+	if(res->tail) res->tail->next = t;
+	else res->head = t;
+	res->tail = t;
+	t->since = (uint32_t)getTimeUs();
+	t->state = RESOURCE_TICKET_QUEUED;
+	res->waiting++;
+	if(res->waiting > res->maxWaiting) res->maxWaiting = res->waiting;
+	if(!bInt) IntMasterEnable();
+}
+
+/**
+ * Take the resource if this ticket is being served and a unit is free
+ */
+uint8_t resourceTryTake(resource *res, resourceTicket *t)
+{
+	bool bInt;
+	uint32_t wait;
+	uint8_t taken = 0;
+
+	bInt = IntMasterDisable();
+	if(res->head == t && res->sem.count > 0) {
+		--res->sem.count;
+		_resourceUnlink(res, t);
+		t->state = RESOURCE_TICKET_HELD;
+		taken = 1;
+	}
+	if(!bInt) IntMasterEnable();
+
+	if(taken) {
+		wait = (uint32_t)getTimeUs() - t->since;
+		res->grants++;
+		res->waitTotal += wait;
+		if(wait > res->waitMax) res->waitMax = wait;
+
+		// Next in queue may be able to take another unit
+		schedSignal(SCHED_EV_RESOURCE | SCHED_EV_TIMED);
+	}
+
+	return taken;
+}
+
+/**
+ * Give a unit of the resource back and wake the waiters
+ */
+void resourceGive(resource *res)
+{
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	PT_SEM_SIGNAL(0, &res->sem);
+	if(!bInt) IntMasterEnable();
+
+	schedSignal(SCHED_EV_RESOURCE | SCHED_EV_TIMED);
+}
+
+void resourceRelease(resource *res, resourceTicket *t)
+{
+	t->state = RESOURCE_TICKET_IDLE;
+	resourceGive(res);
+}
+
+/**
+ * Withdraw a ticket
+ * A queued ticket is unlinked from wherever it is in the queue, the
+ * waiters are woken in case it was at the head
+ */
+void resourceCancel(resource *res, resourceTicket *t)
+{
+	bool bInt;
+
+	if(t->state == RESOURCE_TICKET_HELD) {
+		resourceRelease(res, t);
+		return;
+	}
+	if(t->state != RESOURCE_TICKET_QUEUED) return;
+
+	bInt = IntMasterDisable();
+	_resourceUnlink(res, t);
+	t->state = RESOURCE_TICKET_IDLE;
+	if(!bInt) IntMasterEnable();
+
+	schedSignal(SCHED_EV_RESOURCE | SCHED_EV_TIMED);
+}
@@ -0,0 +1,67 @@
+#ifndef __RESOURCE_H__
+#define __RESOURCE_H__
+
+// Arbitration of shared hardware between protothreads
+//
+// Built on protothread semaphores (pt-sem.h): the semaphore counts free
+// units of the resource, and waiters are served in first-in first-out
+// order with a ticket, so the order of threads in the run queue does not
+// decide who gets the resource. Time spent waiting is accounted per resource.
+//
+// The tickets themselves are linked to the queue, so a cancelled ticket
+// is simply unlinked wherever it is and any number of waiters can cancel.
+
+#include "pt-sem.h"
+
+#define RESOURCE_TIMER				0				// Exact timer pool
+#define RESOURCE_ADC				1				// ADC0 processor triggered conversions
+#define RESOURCE_SSI				2				// SSI0 (NRF24L01)
+#define RESOURCES					3
+
+// Shared resource
+typedef struct _resource {
+	struct pt_sem sem;						// Free units of the resource
+	resourceTicket *head;					// Ticket that may take the resource next
+	resourceTicket *tail;					// Last ticket in the queue
+	uint8_t waiting;						// Current queue length
+	uint8_t maxWaiting;						// Longest queue seen
+	uint32_t grants;						// Number of times resource was taken
+	uint32_t waitTotal;						// Sum of wait times [us]
+	uint32_t waitMax;						// Longest wait [us]
+} resource;
+
+// Static initializer, units is the number of interchangeable units
+#define RESOURCE_INIT(units)	{ { (units) }, 0, 0, 0, 0, 0, 0, 0 }
+
+// Wait in queue until the resource is granted to this thread
+#define RESOURCE_ACQUIRE(pt, res, t)								\
+	do {															\
+		resourceEnqueue((res), (t));								\
+		SCHED_WAIT_UNTIL((pt), 0, SCHED_EV_RESOURCE, resourceTryTake((res), (t)));	\
+	} while(0)
+
+// Give one unit of the resource back
+#define RESOURCE_RELEASE(res, t)	resourceRelease((res), (t))
+
+
+// Resources of the system, indexed with RESOURCE_*
+extern resource resources[RESOURCES];
+
+// Get a ticket, i.e. enter the end of the queue
+void resourceEnqueue(resource *res, resourceTicket *t);
+
+// Take the resource if it is free and ticket is first in queue
+// Returns 1 if resource was taken
+uint8_t resourceTryTake(resource *res, resourceTicket *t);
+
+// Give the resource back, safe to call from interrupts
+void resourceGive(resource *res);
+
+// Give the resource taken with ticket t back
+void resourceRelease(resource *res, resourceTicket *t);
+
+// Leave the queue or give the resource back, whichever the ticket is in
+// Used when a thread holding a ticket is restarted
+void resourceCancel(resource *res, resourceTicket *t);
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * Run-queue scheduler for protothreads
+ *
+ * Replaces the busy-polling main loop. Threads declare the condition
+ * they wait for and are invoked only when it may have changed, otherwise
+ * the core is put to sleep until the next interrupt.
+ *
+ * Uses protothreads (by Adam Dunkels, http://dunkels.com/adam/pt/)
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "inc/tm4c123gh6pm.h"
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+
+#include "driverlib/sysctl.h"
+#include "driverlib/interrupt.h"
+
+#include "pt.h"
+
+#include "common.h"
+#include "sched.h"
+#include "profile.h"
+#include "trace.h"
+#include "eeprom.h"
+#include "bubble.h"
+#include "hx711.h"
+#include "mq3.h"
+#include "ds18b20.h"
+#include "comm.h"
+#include "boot.h"
+#include "power.h"
+
+
+static schedTask schedTasks[SCHED_TASKS];
+static schedTask *schedCurrent = 0;					// Thread being run, 0 if none
+static uint8_t schedProgressed = 0;					// Current thread passed a wait
+
+static volatile uint8_t schedEvents = 0;			// Pending events
+
+static const uint16_t schedLiveness[SCHED_TASKS] = { TASK_TABLE(TASK_LIVENESS) };	// [ms], 0 = none
+#ifdef SCHED_EDF
+static const uint16_t schedDeadlines[SCHED_TASKS] = { TASK_TABLE(TASK_DEADLINE) };	// Relative [ms]
+#endif
+
+
+/**
+ * Initialize every thread of the task table
+ * All threads will be run on next pass
+ */
+void schedInit(void)
+{
+	uint8_t i;
+
+	for(i=0; i < SCHED_TASKS; i++) {
+		PT_INIT(&schedTasks[i].pt);
+		schedTasks[i].timer = 0;
+		schedTasks[i].events = 0;
+		schedTasks[i].progress = getTime();
+		schedTasks[i].restarts = 0;
+#ifdef SCHED_EDF
+		schedTasks[i].ready = 0;
+		schedTasks[i].deadline = 0;
+#endif
+	}
+}
+
+/**
+ * Set pending event bits
+ * Can be called from interrupt handlers
+ */
+void schedSignal(uint8_t events)
+{
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	schedEvents |= events;
+	if(!bInt) IntMasterEnable();
+}
+
+/**
+ * Declare the wait condition of currently running thread
+ * Called from the SCHED_* macros just before the thread returns
+ */
+void schedWait(threadTimer *timer, uint8_t events)
+{
+	if(!schedCurrent) return;
+	schedCurrent->timer = timer;
+	schedCurrent->events = events;
+}
+
+/**
+ * Called from the SCHED_* macros when a wait is passed, or by a thread
+ */
+void schedProgress(void)
+{
+	schedProgressed = 1;
+}
+
+/**
+ * Check whether task can be run with given pending events
+ */
+static uint8_t _schedRunnable(schedTask *task, uint8_t events)
+{
+	if(!task->timer && !task->events) return 1;			// Polled
+	if(task->timer && timerExpired(task->timer)) return 1;	// Timer expired
+	if(task->events & events) return 1;						// Event signalled
+	return 0;
+}
+
+/**
+ * Call thread n, the switch is generated from the task table
+ * Progress is recorded when the thread passed a wait (schedProgress) or
+ * returns from another continuation. Returns 1 if it made progress
+ */
+static inline uint8_t _schedCall(uint8_t n, struct pt *pt)
+{
+	lc_t lc = pt->lc;
+	uint8_t progress;
+
+	schedProgressed = 0;
+	TRACE_EVENT(TRACE_THREAD_RUN, n);
+	switch(n) {
+		TASK_TABLE(TASK_CALL)
+	}
+	progress = (schedProgressed || pt->lc != lc) ? 1 : 0;
+	if(progress) schedTasks[n].progress = getTime();
+	TRACE_EVENT(TRACE_THREAD_RETURN, n | (progress ? 0x100 : 0));
+
+	return progress;
+}
+
+/**
+ * Recover the driver of restarted thread n
+ */
+static inline void _schedRecover(uint8_t n)
+{
+	switch(n) {
+		TASK_TABLE(TASK_RECOVER)
+	}
+}
+
+#ifdef SCHED_EDF
+/**
+ * Absolute deadline of thread n that just became runnable
+ */
+static uint32_t _schedDeadline(uint8_t n, schedTask *task, uint8_t events)
+{
+	if(task->events & events & SCHED_EV_TIMED) return getTime();		// Timed function continuation
+	if(task->timer && timerExpired(task->timer)) return task->timer->deadline + schedDeadlines[n];
+	return getTime() + schedDeadlines[n];
+}
+
+/**
+ * Run the runnable thread with the earliest deadline
+ *
+ * Threads stay ready until they are run, so events taken on this pass
+ * are not lost for the threads that have to wait.
+ */
+uint8_t schedRun(void)
+{
+	uint8_t i;
+	uint8_t events;
+	schedTask *task;
+	schedTask *next = 0;
+	uint8_t nextNum = 0;
+	uint8_t progress;
+
+	PROFILE_PASS();
+
+	IntMasterDisable();
+	events = schedEvents;
+	schedEvents = 0;
+	IntMasterEnable();
+
+	for(i=0; i < SCHED_TASKS; i++) {
+		task = &schedTasks[i];
+		if(!task->ready && _schedRunnable(task, events)) {
+			task->ready = 1;
+			task->deadline = _schedDeadline(i, task, events);
+		}
+		// Earliest deadline, ties in table order
+		if(task->ready && (!next || !TIME_AFTER_EQ(task->deadline, next->deadline))) {
+			next = task;
+			nextNum = i;
+		}
+	}
+	if(!next) return 0;
+
+	next->ready = 0;
+	next->timer = 0;
+	next->events = 0;
+
+	schedCurrent = next;
+	PROFILE_START();
+	progress = _schedCall(nextNum, &next->pt);
+	PROFILE_THREAD_END(nextNum, progress);
+	schedCurrent = 0;
+
+	return 1;
+}
+
+#else
+
+/**
+ * Run every runnable thread once
+ */
+uint8_t schedRun(void)
+{
+	uint8_t i;
+	uint8_t events;
+	uint8_t ran = 0;
+	schedTask *task;
+	uint8_t progress;
+
+	PROFILE_PASS();
+
+	// Take pending events, anything signalled after this is handled on next pass
+	IntMasterDisable();
+	events = schedEvents;
+	schedEvents = 0;
+	IntMasterEnable();
+
+	for(i=0; i < SCHED_TASKS; i++) {
+		task = &schedTasks[i];
+		if(!_schedRunnable(task, events)) continue;
+
+		// Thread is polled unless it declares otherwise before returning
+		task->timer = 0;
+		task->events = 0;
+
+		schedCurrent = task;
+		PROFILE_START();
+		progress = _schedCall(i, &task->pt);
+		PROFILE_THREAD_END(i, progress);
+		ran++;
+	}
+	schedCurrent = 0;
+
+	return ran;
+}
+
+#endif
+
+/**
+ * Sleep until next interrupt if nothing can be run
+ *
+ * Any pending event prevents sleeping, since e.g. a tick must be handled
+ * by handleTimers() before the next one arrives.
+ * Interrupts are disabled while checking so that an event cannot slip in
+ * between the check and WFI. A pending interrupt wakes the core even
+ * when interrupts are masked, and is served after they are enabled again.
+ */
+void schedIdle(void)
+{
+	uint8_t i;
+
+	IntMasterDisable();
+	for(i=0; i < SCHED_TASKS; i++) {
+#ifdef SCHED_EDF
+		if(schedTasks[i].ready) break;
+#endif
+		if(_schedRunnable(&schedTasks[i], 0)) break;
+	}
+
+	if(i == SCHED_TASKS && !schedEvents) {
+		TRACE_EVENT(TRACE_SCHED_SLEEP, 0);
+		powerSetState(POWER_CPU, POWER_SLEEP);
+		PROFILE_IDLE_START();
+		SysCtlSleep();										// WFI, clocks gated (powerInit)
+		PROFILE_IDLE_END();
+		powerSetState(POWER_CPU, POWER_ACTIVE);
+		TRACE_EVENT(TRACE_SCHED_WAKE, 0);
+	}
+	IntMasterEnable();
+}
+
+/**
+ * Check that every supervised thread is live
+ *
+ * Waiting for a timer is always bounded, so the liveness time only runs
+ * while the thread waits for an event or a polled condition. A thread
+ * that has not progressed in time is restarted and its driver recovered.
+ */
+uint8_t schedSupervise(void)
+{
+	uint8_t i;
+	uint8_t live = 1;
+	uint32_t now = getTime();
+	schedTask *task;
+
+	for(i=0; i < SCHED_TASKS; i++) {
+		task = &schedTasks[i];
+		if(!schedLiveness[i]) continue;
+
+		if(task->timer && !timerExpired(task->timer)) {
+			task->progress = now;							// Bounded wait
+			continue;
+		}
+		if(!TIME_AFTER_EQ(now, task->progress + schedLiveness[i])) continue;
+
+		live = 0;
+		if(task->restarts < 0xFFFF) task->restarts++;
+		TRACE_EVENT(TRACE_THREAD_RESTART, i);
+
+		PT_INIT(&task->pt);
+		task->timer = 0;
+		task->events = 0;
+		task->progress = now;
+#ifdef SCHED_EDF
+		task->ready = 0;
+#endif
+		_schedRecover(i);
+	}
+
+	return live;
+}
+
+uint16_t schedGetRestarts(uint8_t n)
+{
+	if(n >= SCHED_TASKS) return 0;
+	return schedTasks[n].restarts;
+}
@@ -0,0 +1,131 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+// Run-queue scheduler for protothreads
+//
+// Every thread tells the scheduler what it is waiting for before it
+// returns: a thread timer, event bits set from interrupts, or nothing
+// (i.e. it is polled on every pass). Only runnable threads are invoked and
+// when nothing is runnable the core sleeps (WFI) until the next interrupt.
+//
+// With SCHED_EDF a thread that becomes runnable gets an absolute deadline
+// from its relative deadline in the task table, counted from the expiry of
+// its timer (or from now if it was polled or signalled). A thread woken by
+// SCHED_EV_TIMED is due immediately, since its timed function holds an exact
+// timer. Only the runnable thread with the earliest deadline is run per pass,
+// so timers and events are re-checked between every thread.
+//
+// Threads are supervised: a thread that waits for something other than a
+// timer must make progress within its liveness time in the task table.
+// Otherwise it is restarted from the beginning and its driver recovered.
+// The watchdog is fed only while all threads are live.
+//
+// Progress is a SCHED_WAIT_* whose condition became true, or a call that
+// returned from another continuation than it started from. A changed
+// continuation alone is not enough: a thread that loops back to a single
+// event wait returns from the same continuation after every round. Threads
+// that wait with plain PT_* macros in such a loop must call schedProgress().
+// Resuming from SCHED_YIELD_WAIT is not progress by itself, so a thread
+// polling a busy device in a yield loop is restarted; poll with
+// SCHED_WAIT_UNTIL on the device status instead.
+
+#include "tasks.h"
+
+#define SCHED_TASKS					TASKS			// One entry per thread in the task table
+
+// Event bits, set from interrupts (or threads) with schedSignal()
+#define SCHED_EV_TICK				0x01			// System tick, thread timers were updated
+#define SCHED_EV_TIMED				0x02			// Exact timer fired or was released
+#define SCHED_EV_UART				0x04			// Character received from UART
+#define SCHED_EV_RESOURCE			0x08			// Shared resource was released
+#define SCHED_EV_ADC				0x10			// Bubble sample block is ready (uDMA)
+#define SCHED_EV_NEVER				0x80			// Never signalled, waited on by stopped threads
+
+// Scheduled thread and the condition it is waiting for
+// If both timer and events are empty, thread is polled on every pass
+typedef struct _schedTask {
+	struct pt pt;
+	threadTimer *timer;						// Runnable when timer has expired
+	uint8_t events;							// Runnable when any of these events is pending
+	uint32_t progress;						// System time [ms] of last progress
+	uint16_t restarts;						// Times restarted by the supervisor
+#ifdef SCHED_EDF
+	uint8_t ready;							// Became runnable, waiting to be run
+	uint32_t deadline;						// Absolute deadline [ms] when ready
+#endif
+} schedTask;
+
+
+// Block the thread until condition is true. Condition is re-evaluated
+// only after timer has expired or one of the events was signalled, so
+// everything that can change the condition must also signal the event.
+#define SCHED_WAIT_UNTIL(pt, timer, events, condition)	\
+	do {												\
+		LC_SET((pt)->lc);								\
+		if(!(condition)) {								\
+			schedWait((timer), (events));				\
+			return PT_WAITING;							\
+		}												\
+		schedProgress();								\
+	} while(0)
+
+// Block the thread until thread timer expires
+#define SCHED_WAIT_TIMER(pt, timer)						\
+	SCHED_WAIT_UNTIL((pt), (timer), 0, timerExpired(timer))
+
+// Block the thread until its next periodic release (periodicTimer)
+#define SCHED_WAIT_PERIOD(pt, p)						\
+	do {												\
+		periodicNext(p);								\
+		SCHED_WAIT_TIMER((pt), &(p)->timer);			\
+		periodicReleased(p);							\
+	} while(0)
+
+// Yield once, continue when timer expires or one of the events is signalled
+#define SCHED_YIELD_WAIT(pt, timer, events)				\
+	do {												\
+		PT_YIELD_FLAG = 0;								\
+		LC_SET((pt)->lc);								\
+		if(PT_YIELD_FLAG == 0) {						\
+			schedWait((timer), (events));				\
+			return PT_YIELDED;							\
+		}												\
+	} while(0)
+
+// Stop the thread for good, e.g. after a one-shot sequence
+// PT_END would restart it on the next call
+#define SCHED_STOP(pt)									\
+	do {												\
+		LC_SET((pt)->lc);								\
+		schedWait(0, SCHED_EV_NEVER);					\
+		return PT_WAITING;								\
+	} while(0)
+
+
+// Initialize all threads of the task table
+void schedInit(void);
+
+// Set event bits, safe to call from interrupts
+void schedSignal(uint8_t events);
+
+// Declare what the currently running thread is waiting for
+void schedWait(threadTimer *timer, uint8_t events);
+
+// Mark progress of the currently running thread for the supervisor
+void schedProgress(void);
+
+// Run all runnable threads once (SCHED_EDF: the most urgent one),
+// returns number of threads run
+uint8_t schedRun(void);
+
+// Sleep until next interrupt if no thread is runnable
+void schedIdle(void);
+
+// Restart threads that missed their liveness deadline
+// Returns 1 if all threads were live, i.e. the watchdog can be fed
+uint8_t schedSupervise(void);
+
+// Get number of supervisor restarts of thread n
+uint16_t schedGetRestarts(uint8_t n);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __TASKS_H__
+#define __TASKS_H__
+
+// Compile-time table of the protothreads
+//
+// Every thread is registered here once. The task numbers, the scheduler
+// dispatch, the setup sequence and the new data collection in main.c are
+// all generated from this table with X-macros, so threads are called
+// directly (no function pointers) and adding a sensor only needs a new line.
+//
+// X(id, setup, thread, flag, newData, resetNewData, collect, deadline, liveness, recover)
+//   id             Name of the task, TASK_<id> is its number
+//   setup          Called once at startup, after the configuration is read
+//   thread         Protothread function
+//   flag           Bit set to newDataFlags when new data was collected (NEW_*)
+//   newData        Returns nonzero when the driver has new data
+//   resetNewData   Clears the new data flag of the driver
+//   collect        Copies the new data to latestData (in main.c), marks the warm state changed
+//   deadline       Relative deadline [ms] after becoming runnable (SCHED_EDF only),
+//                  latency critical threads have short and bulk output long deadlines
+//   liveness       Longest time [ms] the thread may wait without progress, when it
+//                  is not waiting for a timer. 0 = not supervised
+//   recover        Called after the thread was restarted for missing its liveness
+//                  deadline, releases what the thread held and re-initializes the driver
+//
+// Threads are run in table order, or in deadline order with SCHED_EDF.
+// Communications are set up in main() already before the configuration is
+// read, so that it can be reported. The configuration is read by the BOOT
+// thread concurrently with the other threads (boot.h), so setups must not
+// depend on it.
+
+#define TASK_TABLE(X)																														\
+	X(BUBBLE,	bubbleSetup,	bubbleLoop,	NEW_BUBBLE,	bubbleNewData,	bubbleResetNewData,	bubbleCollect,	0,		1000,	bubbleRecover)	\
+	X(HX711,	hx711Setup,		hx711Loop,	NEW_HX711,	hx711NewData,	hx711ResetNewData,	hx711Collect,	2,		3000,	hx711Recover)	\
+	X(MQ3,		mq3setup,		mq3Loop,	NEW_MQ3,	mq3NewData,		mq3ResetNewData,	mq3Collect,		20,		1000,	mq3Recover)		\
+	X(DS,		dsSetup,		dsLoop,		NEW_DS,		dsNewData,		dsResetNewData,		dsCollect,		2,		3000,	dsRecover)		\
+	X(COMM,		taskNone,		commLoop,	0,			taskNoData,		taskNone,			taskNone,		200,	0,		taskNone)		\
+	X(RF,		taskNone,		rfCommLoop,	0,			taskNoData,		taskNone,			taskNone,		50,		1000,	rfCommRecover)	\
+	X(BOOT,		taskNone,		bootLoop,	0,			taskNoData,		taskNone,			taskNone,		500,	0,		taskNone)
+
+// Placeholders for tasks without setup or data, optimized away
+static inline void taskNone(void) { }
+static inline uint8_t taskNoData(void) { return 0; }
+
+
+// Task numbers TASK_<id>, and number of tasks TASKS
+#define TASK_ID(id, setup, thread, flag, newData, resetNewData, collect, deadline, liveness, recover)		TASK_##id,
+enum { TASK_TABLE(TASK_ID) TASKS };
+
+// Call setup of every task
+#define TASK_SETUP(id, setup, thread, flag, newData, resetNewData, collect, deadline, liveness, recover)		setup();
+
+// Switch case calling the thread with protothread state pt
+#define TASK_CALL(id, setup, thread, flag, newData, resetNewData, collect, deadline, liveness, recover)		\
+	case TASK_##id: thread(pt); break;
+
+// Relative deadline of every task, for an array initializer
+#define TASK_DEADLINE(id, setup, thread, flag, newData, resetNewData, collect, deadline, liveness, recover)	(deadline),
+
+// Liveness deadline of every task, for an array initializer
+#define TASK_LIVENESS(id, setup, thread, flag, newData, resetNewData, collect, deadline, liveness, recover)	(liveness),
+
+// Switch case recovering a restarted task
+#define TASK_RECOVER(id, setup, thread, flag, newData, resetNewData, collect, deadline, liveness, recover)	\
+	case TASK_##id: recover(); break;
+
+// Collect new data of every task to latestData and set the flag
+#define TASK_COLLECT(id, setup, thread, flag, newData, resetNewData, collect, deadline, liveness, recover)	\
+	if(newData()) {																							\
+		collect();																							\
+		warmChanged();																						\
+		newDataFlags |= (flag);																				\
+		resetNewData();																						\
+	}
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ * Host replay of the bubble auto level algorithms
+ *
+ * Generates airlock sensor signals with known bubbles at BUBBLE_SAMPLE_RATE
+ * and runs them through the same chain as bubble.c: decimation filter
+ * (filter.c), block processing and the bubble event detector
+ * (bubbledetect.c). Two ways to place the threshold are compared:
+ *
+ *   minmax    the earlier auto level, sensor maximum and minimum that relax
+ *             by 1...3 ADC units every 200 blocks
+ *   quantile  the 2nd and 98th percentiles of the signal (quantile.c), the
+ *             detection is suppressed while they are closer than BUBBLE_LEVEL_MARGIN
+ *
+ * For every scenario the bubbles that were generated, the bubbles found,
+ * the false detections (no generated bubble at that time), the missed
+ * bubbles and the share of time in generated and detected bubbles are
+ * printed. A detector stuck in a bubble shows as a large found %.
+ * Samples can also be replayed from a file, one raw ADC value per line at
+ * BUBBLE_SAMPLE_RATE, in which case only the counts are compared.
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -I. tools/bubblereplay.c filter.c quantile.c bubbledetect.c -o bubblereplay
+ *   ./bubblereplay [sample file]
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+typedef uint8_t bool;
+
+#include "pt.h"
+#include "filter.h"
+#include "quantile.h"
+#include "bubbledetect.h"
+#include "bubble.h"
+
+#define MINMAX_RELAX_BLOCKS		200			// BUBBLE_AUTOLEVEL_CYCLES of the earlier auto level
+#define MATCH_TOLERANCE			(BUBBLE_SAMPLE_RATE / 20)	// [samples] 50 ms around a generated bubble
+
+#define ALGO_MINMAX				0
+#define ALGO_QUANTILE			1
+#define ALGOS					2
+
+static const char *algoNames[ALGOS] = { "minmax", "quantile" };
+
+// Generated signal, times in raw samples
+typedef struct _scenario {
+	const char *name;
+	uint32_t seconds;
+	uint16_t baseline;						// Idle level
+	uint16_t depth;							// Bubble goes this much below the idle level
+	uint32_t period;						// [ms] Between bubbles, 0 = no bubbles
+	uint32_t length;						// [ms] Bubble length
+	uint16_t noise;							// Uniform noise +-
+	uint32_t spikeEvery;					// [ms] Average time between spikes, 0 = none
+	uint16_t spike;							// Spike height, up or down
+	uint32_t stepAt;						// [s] Idle level changes (airlock refilled), 0 = never
+	int16_t step;
+} scenario;
+
+static const scenario scenarios[] = {
+	{ "steady",		600, 2500, 1200, 3000, 150, 20, 0, 0, 0, 0 },
+	{ "busy",		600, 2500, 1200, 800, 300, 20, 0, 0, 0, 0 },
+	{ "spikes",		600, 2500, 1200, 3000, 150, 20, 2000, 1500, 0, 0 },
+	{ "refill",		600, 2500, 1200, 3000, 150, 20, 0, 0, 300, -700 },
+	{ "refill up",	600, 1800, 1200, 3000, 150, 20, 0, 0, 300, 700 },
+	{ "slow",		600, 2500, 1200, 30000, 150, 20, 0, 0, 0, 0 },
+	{ "slow spikes",	600, 2500, 1200, 30000, 150, 20, 5000, 1500, 0, 0 },
+	{ "quiet",		600, 2500, 1200, 0, 0, 40, 0, 0, 0, 0 },
+	{ "quiet spikes",	600, 2500, 1200, 0, 0, 40, 5000, 1500, 0, 0 },
+};
+
+static uint16_t *signal;
+static uint32_t samples;
+static uint32_t *truthStart;				// Generated bubbles
+static uint32_t *truthEnd;
+static uint32_t truths;
+static uint8_t known;						// Bubbles are known, i.e. signal was generated
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t n)
+{
+	seed = seed * 1103515245 + 12345;
+	return n ? (seed >> 8) % n : 0;
+}
+
+static uint16_t clamp12(int32_t x)
+{
+	if(x < 0) return 0;
+	if(x > 0x0FFF) return 0x0FFF;
+	return (uint16_t)x;
+}
+
+/**
+ * Bubbles have soft edges (1/4 of the length), spikes last 1...3 ms
+ */
+static void generate(const scenario *s)
+{
+	uint32_t t, start = 0, spikeEnd = 0;
+	uint32_t rate = BUBBLE_SAMPLE_RATE / 1000;		// Samples per ms
+	uint32_t next;
+	int32_t level, x, edge, pos, spikeLevel = 0;
+
+	samples = s->seconds * BUBBLE_SAMPLE_RATE;
+	signal = realloc(signal, samples * sizeof(uint16_t));
+	truthStart = realloc(truthStart, (samples / 100 + 1) * sizeof(uint32_t));
+	truthEnd = realloc(truthEnd, (samples / 100 + 1) * sizeof(uint32_t));
+	truths = 0;
+	known = 1;
+	seed = 1;
+
+	next = s->period ? rate * (s->period / 2 + rnd(s->period)) : samples;
+	for(t=0; t < samples; t++) {
+		level = s->baseline;
+		if(s->stepAt && t >= s->stepAt * BUBBLE_SAMPLE_RATE) level += s->step;
+
+		// New bubble, period varies +-50 %
+		if(t == next) {
+			start = t;
+			truthStart[truths] = t;
+			truthEnd[truths] = t + s->length * rate;
+			truths++;
+			next = t + rate * (s->period / 2 + rnd(s->period));
+			if(next <= truthEnd[truths - 1]) next = truthEnd[truths - 1] + 1;
+		}
+		x = level;
+		if(truths && t < truthEnd[truths - 1]) {
+			pos = t - start;
+			edge = s->length * rate / 4;
+			if(pos < edge) x -= s->depth * pos / edge;
+			else if((int32_t)(truthEnd[truths - 1] - t) < edge) x -= s->depth * (int32_t)(truthEnd[truths - 1] - t) / edge;
+			else x -= s->depth;
+		}
+
+		if(s->spikeEvery && t >= spikeEnd && !rnd(s->spikeEvery * rate)) {
+			spikeEnd = t + rate * (1 + rnd(3));
+			spikeLevel = rnd(2) ? s->spike : -(int32_t)s->spike;
+		}
+		if(t < spikeEnd) x += spikeLevel;
+
+		x += (int32_t)rnd(2 * s->noise + 1) - s->noise;
+		signal[t] = clamp12(x);
+	}
+}
+
+static uint8_t load(const char *file)
+{
+	FILE *f = fopen(file, "r");
+	uint32_t size = 0;
+	unsigned int value;
+
+	if(!f) return 0;
+	samples = 0;
+	while(fscanf(f, "%u", &value) == 1) {
+		if(samples == size) {
+			size = size ? 2 * size : 65536;
+			signal = realloc(signal, size * sizeof(uint16_t));
+		}
+		signal[samples++] = clamp12(value);
+	}
+	fclose(f);
+	truths = 0;
+	known = 0;
+	return 1;
+}
+
+// Result of one algorithm
+typedef struct _result {
+	uint32_t found;
+	uint32_t falses;
+	uint32_t missed;
+	uint32_t inBubble;						// Filtered samples detected as bubble
+} result;
+
+/**
+ * Same block processing as bubbleLoop, only the limits differ
+ */
+static void run(uint8_t algo, result *r)
+{
+	filter f;
+	bubbleDetector d;
+	quantile low, high;
+	int16_t out[(BUBBLE_BLOCK_SIZE >> BUBBLE_CIC_SHIFT) + 1];
+	uint16_t max = 0x0FFF, min = 0, level = 0x07FF, sample;
+	uint32_t block, t, n, i, match = 0, relax = MINMAX_RELAX_BLOCKS;
+	uint8_t matched = 0, idle = 0;
+
+	filterInit(&f, BUBBLE_CIC_ORDER, BUBBLE_CIC_SHIFT, filterLowpass8, 8);
+	bubbleDetectInit(&d, BUBBLE_FILTER_RATE);
+	quantileInit(&low, BUBBLE_QUANTILE_LOW, BUBBLE_QUANTILE_STEP, min);
+	quantileInit(&high, BUBBLE_QUANTILE_HIGH, BUBBLE_QUANTILE_STEP, max);
+	r->found = r->falses = r->missed = r->inBubble = 0;
+
+	for(block = 0; block + BUBBLE_BLOCK_SIZE <= samples; block += BUBBLE_BLOCK_SIZE) {
+		n = filterBlock(&f, &signal[block], BUBBLE_BLOCK_SIZE, out);
+		if(!n) continue;
+
+		bubbleDetectSetLevel(&d, level, bubbleDetectHysteresis(max, min), 0);
+		for(i=0; i < n; i++) {
+			sample = (out[i] > 0) ? out[i] : 0;
+			if(algo == ALGO_MINMAX) {
+				if(sample > max) max = sample;
+				if(sample < min) min = sample;
+			} else {
+				quantileUpdate(&low, sample);
+				quantileUpdate(&high, sample);
+			}
+			if(idle) continue;
+			if(!bubbleDetectSample(&d, sample)) {
+				r->inBubble += d.inBubble;
+				continue;
+			}
+			r->inBubble++;
+
+			// Bubble started, match to the generated bubbles
+			r->found++;
+			t = block + ((i + 1) << BUBBLE_CIC_SHIFT);
+			while(match < truths && truthEnd[match] + MATCH_TOLERANCE < t) {
+				if(!matched) r->missed++;
+				match++;
+				matched = 0;
+			}
+			if(match < truths && truthStart[match] <= t + MATCH_TOLERANCE && !matched) matched = 1;
+			else r->falses++;
+		}
+		if(idle) bubbleDetectIdle(&d, n);
+
+		if(algo == ALGO_MINMAX) {
+			// Pull limits together, top faster than bottom
+			if(!relax) {
+				relax = MINMAX_RELAX_BLOCKS;
+				for(i=0; i < 3; i++)
+					if(max > min + BUBBLE_LEVEL_MARGIN) max--;
+				if(min < max - BUBBLE_LEVEL_MARGIN) min++;
+			} else {
+				relax--;
+			}
+		} else {
+			max = quantileGet(&high);
+			min = quantileGet(&low);
+		}
+		idle = (algo == ALGO_QUANTILE && max < min + BUBBLE_LEVEL_MARGIN) ? 1 : 0;
+		if(!idle) level = (max / 2) + (min / 2);
+	}
+
+	while(match < truths) {
+		if(!matched) r->missed++;
+		match++;
+		matched = 0;
+	}
+}
+
+static void report(const char *name)
+{
+	result r[ALGOS];
+	uint32_t duty = 0, i;
+	uint8_t a;
+
+	for(i=0; i < truths; i++) duty += truthEnd[i] - truthStart[i];
+
+	for(a=0; a < ALGOS; a++) run(a, &r[a]);
+
+	for(a=0; a < ALGOS; a++) {
+		printf("%-14s %-9s", a ? "" : name, algoNames[a]);
+		if(known)
+			printf(" %9u %7u %7u %7u %10.2f", truths, r[a].found, r[a].falses, r[a].missed,
+				60.0 * r[a].falses * BUBBLE_SAMPLE_RATE / samples);
+		else
+			printf(" %9s %7u %7s %7s %10s", "-", r[a].found, "-", "-", "-");
+		printf(" %10.1f %10.1f\n", known ? 100.0 * duty / samples : 0.0,
+			100.0 * r[a].inBubble * (1 << BUBBLE_CIC_SHIFT) / samples);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t n;
+
+	printf("%-14s %-9s %9s %7s %7s %7s %10s %10s %10s\n", "scenario", "level", "generated", "found", "false", "missed",
+		"false/min", "bubble %", "found %");
+
+	if(argc > 1) {
+		if(!load(argv[1])) {
+			fprintf(stderr, "Cannot read %s\n", argv[1]);
+			return 1;
+		}
+		report(argv[1]);
+		return 0;
+	}
+
+	for(n=0; n < sizeof(scenarios) / sizeof(scenarios[0]); n++) {
+		generate(&scenarios[n]);
+		report(scenarios[n].name);
+	}
+
+	return 0;
+}
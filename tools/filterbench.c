@@ -0,0 +1,100 @@
+/**
+ * Host benchmark of the decimation filter (filter.c)
+ *
+ * Runs a second of noisy 12-bit test signal through every filter
+ * configuration many times and prints the input samples per second, the
+ * number of outputs per second of input and the mean of the output against
+ * the mean of the input, i.e. the gain at DC. The C fallback of
+ * the DSP instructions is used on the host, so the results are the same
+ * as on target and only the speed differs. On target the cost per block
+ * shows in the bubble thread counters of UART command 'i' (PROFILE).
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -I. tools/filterbench.c filter.c -o filterbench && ./filterbench
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+typedef uint8_t bool;
+
+#include "filter.h"
+
+#define BENCH_SAMPLES		1000		// One second at BUBBLE_SAMPLE_RATE
+#define BENCH_ROUNDS		20000
+
+typedef struct _benchConfig {
+	const char *name;
+	uint8_t order;
+	uint8_t rateShift;
+	const int16_t *coef;
+	uint8_t taps;
+} benchConfig;
+
+static const benchConfig configs[] = {
+	{ "cic N=1 R=4",		1, 2, 0, 0 },
+	{ "cic N=2 R=2",		2, 1, 0, 0 },
+	{ "cic N=3 R=8",		3, 3, 0, 0 },
+	{ "fir 8",				0, 0, filterLowpass8, 8 },
+	{ "cic N=2 R=2 + fir 8",	2, 1, filterLowpass8, 8 },
+	{ "cic N=3 R=8 + fir 8",	3, 3, filterLowpass8, 8 },
+};
+
+static uint16_t input[BENCH_SAMPLES];
+static int16_t output[BENCH_SAMPLES + 1];
+
+// Mid-scale level with pseudo random noise and some spikes
+static void makeInput(void)
+{
+	uint32_t seed = 12345;
+	uint16_t i;
+
+	for(i=0; i < BENCH_SAMPLES; i++) {
+		seed = seed * 1103515245 + 12345;
+		input[i] = 2000 + ((seed >> 16) & 0x3F) - 32;
+		if(i % 97 == 0) input[i] = 400;
+	}
+}
+
+int main(void)
+{
+	filter f;
+	uint16_t n, i;
+	uint32_t round;
+	uint32_t outputs;
+	int64_t sum;
+	double mean = 0;
+	double seconds;
+	struct timespec start, end;
+	volatile int16_t sink = 0;
+
+	makeInput();
+	for(i=0; i < BENCH_SAMPLES; i++) mean += input[i];
+	mean /= BENCH_SAMPLES;
+
+	printf("%-22s %14s %8s %8s\n", "filter", "samples/s", "outputs", "dc gain");
+	for(n=0; n < sizeof(configs) / sizeof(configs[0]); n++) {
+		filterInit(&f, configs[n].order, configs[n].rateShift, configs[n].coef, configs[n].taps);
+
+		outputs = 0;
+		sum = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(round=0; round < BENCH_ROUNDS; round++) {
+			outputs = filterBlock(&f, input, BENCH_SAMPLES, output);
+			sink ^= output[0];
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+		// Average of the last round against the average of the input
+		for(i=0; i < outputs; i++) sum += output[i];
+
+		printf("%-22s %14.0f %8u %8.3f\n", configs[n].name,
+			(double)BENCH_SAMPLES * BENCH_ROUNDS / seconds, outputs,
+			outputs ? (double)sum / outputs / mean : 0.0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Benchmark of the local continuation backends of protothreads
+# (lc-switch.h and lc-addrlabels.h, selected with LC_ADDRLABELS)
+#
+# Code size: every protothread and timed function is compiled with both
+# backends and the sizes of the functions are printed side by side.
+#
+# Resume cost: build the firmware with PROFILE defined (common.h), once
+# with and once without LC_ADDRLABELS, let it run for a while and print
+# the counters with UART command 'i'. The shortest run (L) of a thread or
+# timed function is the cost of resuming it and checking what it waits for.
+#
+# Usage: TIVAWARE=/path/to/TivaWare tools/lcbench.sh
+# Cross compiler can be changed with CC and NM, flags with CFLAGS
+#
+# Copyright (C) 2016 Lauri Peltonen
+
+CC=${CC:-arm-none-eabi-gcc}
+NM=${NM:-arm-none-eabi-nm}
+CFLAGS=${CFLAGS:-"-mcpu=cortex-m4 -mthumb -mfloat-abi=hard -mfpu=fpv4-sp-d16 -Os -ffunction-sections -std=gnu99 -DPART_TM4C123GH6PM -DTARGET_IS_BLIZZARD_RB1"}
+
+if [ -z "$TIVAWARE" ]; then
+	echo "Set TIVAWARE to the TivaWare directory" >&2
+	exit 1
+fi
+
+cd "$(dirname "$0")/.." || exit 1
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# All protothreads and timed functions
+FUNCS=$( (sed -n 's/^PT_THREAD(\([A-Za-z0-9_]*\)(.*/\1/p' *.c
+	sed -n 's/^[[:space:]]*TIMED_FUNCTION(\([A-Za-z0-9_]*\)).*/\1/p' *.c) | sort -u)
+
+for backend in switch addrlabels; do
+	if [ $backend = addrlabels ]; then DEF=-DLC_ADDRLABELS; else DEF=; fi
+	for f in *.c; do
+		$CC $CFLAGS $DEF -I. -I"$TIVAWARE" -c "$f" -o "$OUT/${f%.c}.$backend.o" || exit 1
+	done
+	$NM --print-size --radix=d "$OUT"/*.$backend.o | awk 'NF == 4 { print $4, $2 + 0 }' > "$OUT/$backend.size"
+done
+
+printf "%-24s %8s %8s %8s\n" "function" "switch" "labels" "diff"
+for fn in $FUNCS; do
+	a=$(awk -v f="$fn" '$1 == f { print $2 }' "$OUT/switch.size")
+	b=$(awk -v f="$fn" '$1 == f { print $2 }' "$OUT/addrlabels.size")
+	[ -z "$a" ] && [ -z "$b" ] && continue
+	printf "%-24s %8s %8s %8d\n" "$fn" "${a:-0}" "${b:-0}" $(( ${b:-0} - ${a:-0} ))
+done
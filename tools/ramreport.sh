@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Static RAM and flash budget of the firmware modules
+#
+# Every module is compiled the same way as in tools/lcbench.sh and the flash
+# (code and constants, plus initial values of data) and static RAM (data and
+# bss) of each one is printed, with the totals against the 256 KB flash and
+# 32 KB SRAM of the TM4C123GH6PM. The largest variables in RAM are listed
+# after that, including the function-static buffers of the threads.
+#
+# Only the modules of this repository are counted, driverlib, the startup
+# code and the stack come on top. Stack use is measured on target with UART
+# command 'm' (stack painting, see stackPaint() in common.c).
+#
+# Build options can be given as arguments to see what they cost, e.g.
+#   TIVAWARE=/path/to/TivaWare tools/ramreport.sh -DPROFILE -DTRACE
+# Cross compiler can be changed with CC, SIZE and NM, flags with CFLAGS
+#
+# Copyright (C) 2016 Lauri Peltonen
+
+CC=${CC:-arm-none-eabi-gcc}
+SIZE=${SIZE:-arm-none-eabi-size}
+NM=${NM:-arm-none-eabi-nm}
+CFLAGS=${CFLAGS:-"-mcpu=cortex-m4 -mthumb -mfloat-abi=hard -mfpu=fpv4-sp-d16 -Os -ffunction-sections -fdata-sections -std=gnu99 -DPART_TM4C123GH6PM -DTARGET_IS_BLIZZARD_RB1"}
+
+FLASH_SIZE=262144
+SRAM_SIZE=32768
+LARGEST=15
+
+if [ -z "$TIVAWARE" ]; then
+	echo "Set TIVAWARE to the TivaWare directory" >&2
+	exit 1
+fi
+
+cd "$(dirname "$0")/.." || exit 1
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+for f in *.c; do
+	$CC $CFLAGS "$@" -I. -I"$TIVAWARE" -c "$f" -o "$OUT/${f%.c}.o" || exit 1
+done
+
+# text data bss per object
+$SIZE -B "$OUT"/*.o | awk -v flash="$FLASH_SIZE" -v sram="$SRAM_SIZE" '
+	NR == 1 { printf "%-16s %8s %8s %8s %8s\n", "module", "flash", "data", "bss", "ram"; next }
+	{
+		n = split($6, p, "/"); m = p[n]; sub(/\.o$/, "", m)
+		printf "%-16s %8d %8d %8d %8d\n", m, $1 + $2, $2, $3, $2 + $3
+		tf += $1 + $2; td += $2; tb += $3
+	}
+	END {
+		printf "%-16s %8d %8d %8d %8d\n", "total", tf, td, tb, td + tb
+		printf "flash %.1f %% of %d, static RAM %.1f %% of %d\n", 100 * tf / flash, flash, 100 * (td + tb) / sram, sram
+	}'
+
+echo
+echo "Largest variables in RAM"
+$NM -A --print-size --size-sort --radix=d "$OUT"/*.o | awk 'NF == 4 && $3 ~ /^[bBdD]$/ {
+		split($1, p, ":"); n = split(p[1], q, "/"); m = q[n]; sub(/\.o$/, "", m)
+		printf "%8d  %-16s %s\n", $2 + 0, m, $4
+	}' | sort -rn | head -n $LARGEST
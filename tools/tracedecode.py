@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+#
+# Decoder of the event trace (trace.h) read out with UART or RF command 't'
+#
+# Reads a captured serial log (file or stdin), picks the trace records from
+# it and prints them as a timeline with the time since reset, the time since
+# the previous event and the event decoded. Thread run times are summed up
+# at the end of each read out. Other lines in the log are ignored.
+#
+# Records, all numbers in hex:
+#   Z<lost><cycles><us>		Header, events lost before the read out and
+#							timebase in cycles and in us at read out
+#   X<time><id><arg>		Event, timebase cycles (low 32 bits), 16-bit id and argument
+#   K						End of the read out (UART)
+#
+# Usage: tracedecode.py [log file]
+#
+
+import sys
+
+CLOCKS_IN_US = 80
+
+# Task table order (tasks.h)
+THREADS = ["bubble", "hx711", "mq3", "ds18b20", "comm", "rf", "boot"]
+
+# RF_MODE_* (comm.h)
+RF_MODES = {1: "data", 2: "config", 3: "bubbles", 10: "dump", 11: "writeconf", 12: "profile",
+			13: "trace", 80: "ack", 90: "done", 100: "ping"}
+
+RF_STATUS = {0: "busy", 1: "ok", 2: "fail"}
+
+
+def thread(n):
+	return THREADS[n] if n < len(THREADS) else "thread%d" % n
+
+
+def char(c):
+	return chr(c) if 32 <= c < 127 else "0x%02X" % c
+
+
+# Event id: (name, argument formatter)
+EVENTS = {
+	0x0100: ("run", lambda a: thread(a)),
+	0x0101: ("return", lambda a: thread(a & 0xFF) + ("" if a & 0x100 else " (no progress)")),
+	0x0102: ("restart", lambda a: thread(a)),
+	0x0103: ("sleep", None),
+	0x0104: ("wake", None),
+	0x0200: ("timed wait", lambda a: "%d us" % a),
+	0x0201: ("timed spin", lambda a: "%d us" % a),
+	0x0300: ("isr timer", lambda a: "exact timer %d" % a),
+	0x0301: ("isr uart", lambda a: char(a)),
+	0x0302: ("isr adc", lambda a: "block %d%s" % (a & 0xFF, " overrun" if a & 0x100 else "")),
+	0x0303: ("isr co2", lambda a: "dropped" if a & 0x100 else "level %d" % (a & 0xFF)),
+	0x0400: ("eeprom write", lambda a: "block %d" % a),
+	0x0401: ("eeprom config", None),
+	0x0402: ("eeprom fail", lambda a: "status %d" % a),
+	0x0500: ("rf mode", lambda a: RF_MODES.get(a, str(a))),
+	0x0501: ("rf tx", lambda a: "%s %s" % (char(a >> 8), RF_STATUS.get(a & 0xFF, str(a & 0xFF)))),
+	0x0502: ("rf rx", lambda a: char(a)),
+	0x0600: ("isr tick", None),
+}
+
+
+def decode(header, events):
+	"""Print one read out"""
+	lost, now_cycles, now_us = header
+
+	# Unwrap the 32-bit timebase forward, then place the read out after the last event
+	total = []
+	t = 0
+	prev = None
+	for time, _, _ in events:
+		if prev is not None:
+			t += (time - prev) & 0xFFFFFFFF
+		total.append(t)
+		prev = time
+	end = t + (((now_cycles - prev) & 0xFFFFFFFF) if prev is not None else 0)
+
+	print("%d events, %d lost before read out" % (len(events), lost))
+
+	running = {}
+	stats = {}
+	last_us = None
+	for (time, eid, arg), t in zip(events, total):
+		us = now_us - (end - t) / CLOCKS_IN_US
+		delta = "" if last_us is None else "+%.3f" % (us - last_us)
+		last_us = us
+
+		name, fmt = EVENTS.get(eid, ("event 0x%04X" % eid, lambda a: "0x%04X" % a))
+		text = name if not fmt else "%s %s" % (name, fmt(arg))
+		print("%14.3f %12s  %s" % (us, delta, text))
+
+		# Thread run times
+		if eid == 0x0100:
+			running[arg] = t
+		elif eid == 0x0101 and (arg & 0xFF) in running:
+			n = arg & 0xFF
+			d = (t - running.pop(n)) / CLOCKS_IN_US
+			runs, sum_us, max_us = stats.get(n, (0, 0.0, 0.0))
+			stats[n] = (runs + 1, sum_us + d, max(max_us, d))
+
+	if stats:
+		print("%-10s %6s %12s %10s" % ("thread", "runs", "total [us]", "max [us]"))
+		for n in sorted(stats):
+			runs, sum_us, max_us = stats[n]
+			print("%-10s %6d %12.3f %10.3f" % (thread(n), runs, sum_us, max_us))
+	print()
+
+
+def main():
+	f = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+
+	header = None
+	events = []
+	for line in f:
+		line = line.strip()
+		try:
+			if line.startswith("Z") and len(line) == 25:
+				if header:
+					decode(header, events)
+				header = (int(line[1:9], 16), int(line[9:17], 16), int(line[17:25], 16))
+				events = []
+			elif line.startswith("X") and len(line) == 17 and header:
+				events.append((int(line[1:9], 16), int(line[9:13], 16), int(line[13:17], 16)))
+			elif line == "K" and header:
+				decode(header, events)
+				header = None
+		except ValueError:
+			continue					# Not a trace record
+
+	if header:
+		decode(header, events)
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,94 @@
+/**
+ * Binary event trace to a RAM ring buffer
+ *
+ * Records fixed-size events from threads and interrupts, so that timing
+ * problems can be looked at without adding UART output that changes the
+ * timing itself. See trace.h.
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "inc/tm4c123gh6pm.h"
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+
+#include "driverlib/interrupt.h"
+
+#include "pt.h"
+
+#include "common.h"
+#include "trace.h"
+
+#ifdef TRACE
+
+#if (TRACE_SIZE & (TRACE_SIZE - 1)) != 0
+#error "TRACE_SIZE must be a power of 2"
+#endif
+
+static traceEvent traceBuffer[TRACE_SIZE];
+static uint32_t traceHead = 0;					// Events recorded since last read out
+static uint8_t traceReaders = 0;				// Read outs in progress, recording is paused while nonzero
+static uint16_t traceCount = 0;					// Events in the paused buffer
+
+
+/**
+ * Record an event, the oldest one is overwritten when the buffer is full
+ * Interrupts are disabled so that the time stamps stay in buffer order
+ * even when an interrupt records in the middle.
+ */
+void traceRecord(uint16_t id, uint16_t arg)
+{
+	traceEvent *e;
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	if(!traceReaders) {
+		e = &traceBuffer[traceHead++ & (TRACE_SIZE - 1)];
+		e->time = (uint32_t)getCycles();				// Timebase, keeps counting in sleep
+		e->id = id;
+		e->arg = arg;
+	}
+	if(!bInt) IntMasterEnable();
+}
+
+uint16_t traceFreeze(void)
+{
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	if(!traceReaders)
+		traceCount = (traceHead < TRACE_SIZE) ? traceHead : TRACE_SIZE;
+	traceReaders++;
+	if(!bInt) IntMasterEnable();
+
+	return traceCount;
+}
+
+const traceEvent *traceGet(uint16_t n)
+{
+	if(!traceReaders || n >= traceCount) return 0;
+	return &traceBuffer[(traceHead - traceCount + n) & (TRACE_SIZE - 1)];
+}
+
+uint32_t traceGetLost(void)
+{
+	return traceHead - traceCount;
+}
+
+void traceResume(void)
+{
+	bool bInt;
+
+	bInt = IntMasterDisable();
+	if(traceReaders) traceReaders--;
+	if(!traceReaders) {
+		traceHead = 0;
+		traceCount = 0;
+	}
+	if(!bInt) IntMasterEnable();
+}
+
+#endif
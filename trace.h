@@ -0,0 +1,93 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// Binary event trace
+//
+// Enabled by defining TRACE in common.h. Events from the scheduler, timed
+// functions, interrupts, EEPROM writes and the radio thread are recorded as
+// fixed-size binary records into a RAM ring buffer, which takes a few dozen
+// cycles and prints nothing, so tracing does not move the timing the way
+// UART debug lines do. Without TRACE the TRACE_EVENT() macro compiles to nothing.
+//
+// The buffer is read out with UART or RF command 't', recording is paused
+// meanwhile and the buffer is cleared after the last reader has finished. tools/tracedecode.py renders
+// the records as a timeline. Time is the low 32 bits of the timebase
+// (getCycles), which unlike the DWT counter keeps counting while the core
+// sleeps. The decoder unwraps it, so consecutive events must be less than
+// ~53 s apart.
+
+#define TRACE_SIZE					128				// Ring buffer size in events, power of 2
+
+// Recorded event, 8 bytes
+typedef struct _traceEvent {
+	uint32_t time;							// Cycle counter
+	uint16_t id;							// TRACE_* event, category in the high byte
+	uint16_t arg;
+} traceEvent;
+
+// Event categories, high byte of the event id
+#define TRACE_CAT_SCHED				1
+#define TRACE_CAT_TIMED				2
+#define TRACE_CAT_ISR				3
+#define TRACE_CAT_EEPROM			4
+#define TRACE_CAT_RF				5
+#define TRACE_CAT_TICK				6				// System tick, 1000 events per second
+
+// Categories that are recorded, the tick would overwrite everything else in 0.1 s
+#ifndef TRACE_MASK
+#define TRACE_MASK					((1 << TRACE_CAT_SCHED) | (1 << TRACE_CAT_TIMED) | (1 << TRACE_CAT_ISR) | \
+									 (1 << TRACE_CAT_EEPROM) | (1 << TRACE_CAT_RF))
+#endif
+
+// Events and their arguments
+#define TRACE_THREAD_RUN			0x0100			// Thread called, arg = thread
+#define TRACE_THREAD_RETURN			0x0101			// Thread returned, arg = thread, bit 8 set if it made progress
+#define TRACE_THREAD_RESTART		0x0102			// Thread restarted by the supervisor, arg = thread
+#define TRACE_SCHED_SLEEP			0x0103			// Core went to sleep
+#define TRACE_SCHED_WAKE			0x0104			// Core woke up
+#define TRACE_TIMED_WAIT			0x0200			// Exact timer started, arg = wait [us]
+#define TRACE_TIMED_SPIN			0x0201			// Wait was spun, arg = wait [us]
+#define TRACE_ISR_TIMED				0x0300			// Exact timer interrupt, arg = timer
+#define TRACE_ISR_UART				0x0301			// Character received, arg = character
+#define TRACE_ISR_ADC				0x0302			// Bubble sample block ready, arg = buffer, bit 8 set if it was not processed in time
+#define TRACE_ISR_CO2				0x0303			// Hall switch edge, arg = level, bit 8 set if the edge buffer was full
+#define TRACE_EEPROM_WRITE			0x0400			// Data block written, arg = block
+#define TRACE_EEPROM_CONFIG			0x0401			// Configuration written
+#define TRACE_EEPROM_FAIL			0x0402			// EEPROMProgram failed, arg = status
+#define TRACE_RF_MODE				0x0500			// Radio thread changed mode, arg = RF_MODE_*
+#define TRACE_RF_TX					0x0501			// Packet sent, arg = type (first byte) << 8 | RF24_TX_* status
+#define TRACE_RF_RX					0x0502			// Packet received, arg = command (first byte)
+#define TRACE_ISR_TICK				0x0600			// System tick interrupt
+
+#ifdef TRACE
+
+// Record event id with arg, safe to call from interrupts
+// The category check is resolved at compile time
+#define TRACE_EVENT(id, arg)										\
+	do {															\
+		if(TRACE_MASK & (1 << ((id) >> 8)))							\
+			traceRecord((id), (uint16_t)(arg));						\
+	} while(0)
+
+#else
+
+#define TRACE_EVENT(id, arg)
+
+#endif
+
+void traceRecord(uint16_t id, uint16_t arg);
+
+// Pause recording for read out, returns number of events in the buffer
+// Every reader must call traceResume() once when done
+uint16_t traceFreeze(void);
+
+// Get event n of the paused buffer, 0 is the oldest, 0 if not paused or out of range
+const traceEvent *traceGet(uint16_t n);
+
+// Number of events overwritten before the read out
+uint32_t traceGetLost(void);
+
+// Reader is done, the last one clears the buffer and continues recording
+void traceResume(void);
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * Warm restart state preservation
+ *
+ * Keeps the live counters and the EEPROM write position in RAM that is
+ * not initialized at startup, protected with CRC-32, so that a reset
+ * which keeps RAM powered does not lose the counts since the last store.
+ *
+ * Copyright (C) 2016 Lauri Peltonen
+ */
+
+#include <stdint.h>
+typedef uint8_t bool;
+
+#include "inc/tm4c123gh6pm.h"
+#include "inc/hw_types.h"
+#include "inc/hw_memmap.h"
+
+#include "driverlib/sysctl.h"
+
+#include "pt.h"
+
+#include "common.h"
+#include "eeprom.h"
+#include "bubble.h"
+#include "warm.h"
+
+
+// Not cleared nor initialized by the startup code
+static warmState warmBlock[WARM_COPIES] __attribute__((section(".noinit")));
+static uint8_t warmNext = 0;								// Copy to write next
+static uint32_t warmSequence = 0;
+static uint8_t warmDirty = 1;								// State changed since last save
+
+// CRC-32 (IEEE 802.3, reflected) with a 16 entry table, i.e. 4 bits per step
+static const uint32_t warmCrcTable[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+
+
+static uint32_t _warmCrc(const uint8_t *data, uint32_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	while(len--) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ warmCrcTable[crc & 0x0F];
+		crc = (crc >> 4) ^ warmCrcTable[crc & 0x0F];
+	}
+	return ~crc;
+}
+
+// CRC of a copy, from sequence up to the crc field
+static uint32_t _warmStateCrc(const warmState *s)
+{
+	return _warmCrc((const uint8_t *)&s->sequence, (const uint8_t *)&s->crc - (const uint8_t *)&s->sequence);
+}
+
+static uint8_t _warmValid(const warmState *s)
+{
+	return s->magic == WARM_MAGIC && _warmStateCrc(s) == s->crc;
+}
+
+/**
+ * Find the newest valid copy
+ * After power-on the RAM content is random, so it is not trusted even if
+ * the CRC would happen to match
+ */
+const warmState *warmLoad(uint32_t resetCause)
+{
+	const warmState *found = 0;
+	uint8_t i;
+
+	if(resetCause & SYSCTL_CAUSE_POR) return 0;
+
+	for(i=0; i < WARM_COPIES; i++) {
+		if(!_warmValid(&warmBlock[i])) continue;
+		if(!found || (int32_t)(warmBlock[i].sequence - found->sequence) > 0) {
+			found = &warmBlock[i];
+			warmNext = (i + 1) % WARM_COPIES;				// Keep the found copy until next one is written
+		}
+	}
+	if(found) warmSequence = found->sequence;
+
+	return found;
+}
+
+void warmChanged(void)
+{
+	warmDirty = 1;
+}
+
+/**
+ * Save the state to the older copy
+ * Copying and the CRC take a while, so nothing is done if the state has
+ * not changed since the last save
+ */
+void warmSave(const eConfig *config, const eData *latest)
+{
+	warmState *s = &warmBlock[warmNext];
+
+	if(!warmDirty) return;
+	warmDirty = 0;
+
+	s->magic = 0;										// Invalid while being written
+	s->sequence = ++warmSequence;
+	s->config = *config;
+	s->latest = *latest;
+	eGetCursor(&s->cursor);
+	bubbleGetState(&s->bubble);
+	s->crc = _warmStateCrc(s);
+	s->magic = WARM_MAGIC;
+
+	warmNext = (warmNext + 1) % WARM_COPIES;
+}
@@ -0,0 +1,44 @@
+#ifndef __WARM_H__
+#define __WARM_H__
+
+// Warm restart state in non-initialized RAM
+//
+// The bubble counters, auto level state, configuration, latest collected
+// data and the EEPROM write position are copied to a block that the
+// startup code does not clear, on the main loop pass after they changed. After a watchdog,
+// brown-out or other reset that keeps the RAM powered, the block is found
+// valid (magic and CRC) and the system continues from it without losing
+// counts or searching the EEPROM data area.
+//
+// The linker script must place .noinit to SRAM without loading or zeroing
+// it, e.g. inside the SRAM region:  .noinit (NOLOAD) : { *(.noinit*) } > SRAM
+// before .bss, since the stack is painted from the end of .bss (stackPaint)
+//
+// Two copies are written in turns, so a reset in the middle of an update
+// still leaves the previous copy valid.
+
+#define WARM_MAGIC				0x5741524D		// "WARM"
+#define WARM_COPIES				2
+
+// Saved state
+typedef struct _warmState {
+	uint32_t magic;
+	uint32_t sequence;						// Newer copy has the larger sequence
+	eConfig config;
+	eData latest;
+	eCursor cursor;
+	bubbleState bubble;
+	uint32_t crc;							// CRC-32 from sequence to here
+} warmState;
+
+// Find valid state saved before reset, resetCause from SysCtlResetCauseGet()
+// Returns 0 after power-on or if no copy is valid
+const warmState *warmLoad(uint32_t resetCause);
+
+// Mark the state changed: new data collected, configuration changed or EEPROM written
+void warmChanged(void);
+
+// Save current state if it was marked changed, called on every main loop pass
+void warmSave(const eConfig *config, const eData *latest);
+
+#endif